@@ -0,0 +1,324 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#ifndef BASIC_MOTOR_H
+#define BASIC_MOTOR_H
+
+#include "Arduino.h"
+#include "DynamixelUtils.h"
+#include "DynamixelRegister.h"
+#include "DynamixelConversion.h"
+#include "DynamixelFixedPoint.h"
+#include "DynamixelManager.h"
+
+//! Statically dispatched motor, for the hot paths
+/*!
+ * Unlike DynamixelMotor, nothing here is virtual : the motor model is given by the Derived class (CRTP) and registers
+ * are known at compile time, so that setGoalAngle() compiles down to a straight-line frame build followed by the
+ * transmission, with no indirect call.
+ * <br>The Derived class has to define :
+ * \li the GoalAngle, CurrentAngle, GoalVelocity, CurrentVelocity, CurrentTorque, TorqueEnable, LED and OperatingMode
+ * Register types
+ * \li angleConversionFactor and velocityConversionFactor, as static constexpr floats
+ * \li AngleScale and VelocityScale FixedPointScale types, for the fixed-point functions
+ * \li a static model() function returning its DynamixelModel, for BasicMotorAdapter
+ *
+ * Frames are built for Dynamixel Protocol v2, a Derived class can hide the frame functions for another protocol.
+ * \sa StaticXL430
+ */
+template<typename Derived>
+class BasicMotor {
+
+public:
+
+    BasicMotor(uint8_t id, const DynamixelManager& dynamixelManager) : manager(dynamixelManager), motorID(id)
+    {}
+
+    uint8_t getId() const
+    {
+        return(motorID);
+    }
+
+    bool setGoalAngle(float targetAngleDegree)
+    {
+        typedef typename Derived::GoalAngle Reg;
+        return(write<Reg>((typename Reg::type)unitsToValue(targetAngleDegree, Derived::angleConversionFactor, Reg::length)));
+    }
+
+    bool getCurrentAngle(float& angle)
+    {
+        typename Derived::CurrentAngle::type value;
+        bool status = read<typename Derived::CurrentAngle>(value);
+        angle = value*Derived::angleConversionFactor;
+        return(status);
+    }
+
+    bool setGoalVelocity(float targetVelocity)
+    {
+        typedef typename Derived::GoalVelocity Reg;
+        return(write<Reg>((typename Reg::type)unitsToValue(targetVelocity, Derived::velocityConversionFactor, Reg::length)));
+    }
+
+    bool getCurrentVelocity(float& velocity)
+    {
+        typename Derived::CurrentVelocity::type value;
+        bool status = read<typename Derived::CurrentVelocity>(value);
+        velocity = value*Derived::velocityConversionFactor;
+        return(status);
+    }
+
+    bool setGoalAngleFixed(Millidegrees targetAngle)
+    {
+        typedef typename Derived::GoalAngle Reg;
+        return(write<Reg>((typename Reg::type)Derived::AngleScale::toValue(targetAngle, Reg::length)));
+    }
+
+    bool getCurrentAngleFixed(Millidegrees& angle)
+    {
+        typename Derived::CurrentAngle::type value;
+        bool status = read<typename Derived::CurrentAngle>(value);
+        angle = Derived::AngleScale::fromValue(value);
+        return(status);
+    }
+
+    bool setGoalVelocityFixed(MilliRpm targetVelocity)
+    {
+        typedef typename Derived::GoalVelocity Reg;
+        return(write<Reg>((typename Reg::type)Derived::VelocityScale::toValue(targetVelocity, Reg::length)));
+    }
+
+    bool getCurrentVelocityFixed(MilliRpm& velocity)
+    {
+        typename Derived::CurrentVelocity::type value;
+        bool status = read<typename Derived::CurrentVelocity>(value);
+        velocity = Derived::VelocityScale::fromValue(value);
+        return(status);
+    }
+
+    bool getCurrentTorque(int& torque)
+    {
+        typename Derived::CurrentTorque::type value;
+        bool status = read<typename Derived::CurrentTorque>(value);
+        torque = value;
+        return(status);
+    }
+
+    bool toggleTorque(bool state)
+    {
+        return(write<typename Derived::TorqueEnable>(state));
+    }
+
+    bool changeLED(bool state)
+    {
+        return(write<typename Derived::LED>(state));
+    }
+
+    bool getOperatingMode(uint8_t& mode)
+    {
+        return(read<typename Derived::OperatingMode>(mode));
+    }
+
+    bool setOperatingMode(uint8_t mode)
+    {
+        return(write<typename Derived::OperatingMode>(mode));
+    }
+
+    template<typename Reg>
+    bool write(typename Reg::type value)
+    {
+        uint8_t packetSize = Derived::template makeWritePacket<Reg>(manager.txBuffer, motorID, value);
+        return(checkAnswer(manager.sendFrame(packetSize, 11)));
+    }
+
+    template<typename Reg>
+    bool read(typename Reg::type& value)
+    {
+        uint8_t packetSize = Derived::makeReadPacket(manager.txBuffer, motorID, Reg::address, Reg::length);
+        const char* returnPacket = manager.sendFrame(packetSize, 11 + Reg::length);
+        if(!checkAnswer(returnPacket))
+        {
+            value = 0;
+            return(false);
+        }
+        value = Reg::load(returnPacket + dynamixelV2::responseParameterStart);
+        return(true);
+    }
+
+    //! Checks an answer of this motor, and records its alert bit in the manager registry
+    bool checkAnswer(const char* packet) const
+    {
+        bool alert;
+        if(!Derived::decapsulatePacket(packet, alert))
+        {
+            return(false);
+        }
+        manager.noteAlert(motorID, alert);
+        return(true);
+    }
+
+    /*!
+     * \name Protocol v2 frames
+     * Static, so that BasicMotorAdapter can use them without a BasicMotor instance.
+     */
+    //!@{
+
+    //! Builds a write frame for a register known at compile time, returns the frame size
+    template<typename Reg>
+    static uint8_t makeWritePacket(char* packet, uint8_t id, typename Reg::type value)
+    {
+        constexpr uint8_t instructionLength = dynamixelV2::minInstructionLength + Reg::length;
+        packet[0] = v2Header[0];
+        packet[1] = v2Header[1];
+        packet[2] = v2Header[2];
+        packet[3] = v2Header[3];
+        packet[dynamixelV2::idPos] = id;
+        packet[dynamixelV2::lengthLSBPos] = instructionLength;
+        packet[dynamixelV2::lengthMSBPos] = 0;
+        packet[dynamixelV2::instructionPos] = dynamixelV2::writeInstruction;
+        packet[8] = Reg::address & 0xFF;
+        packet[9] = (Reg::address >> 8) & 0xFF;
+        Reg::store(packet + 10, value);
+
+        unsigned short crc = crc_compute(packet, instructionLength + 5);
+        packet[10 + Reg::length] = crc & 0xFF;
+        packet[11 + Reg::length] = (crc >> 8) & 0xFF;
+        return(dynamixelV2::minPacketLength + Reg::length);
+    }
+
+    //! Builds a write frame for a register only known at runtime, returns the frame size
+    static uint8_t makeWritePacket(char* packet, uint8_t id, const DynamixelAccessData& accessData, const char* parameters)
+    {
+        uint8_t instructionLength = dynamixelV2::minInstructionLength + accessData.length;
+        memcpy(packet, v2Header, 4);
+        packet[dynamixelV2::idPos] = id;
+        packet[dynamixelV2::lengthLSBPos] = instructionLength;
+        packet[dynamixelV2::lengthMSBPos] = 0;
+        packet[dynamixelV2::instructionPos] = dynamixelV2::writeInstruction;
+        packet[8] = accessData.address[0];
+        packet[9] = accessData.address[1];
+        memcpy(packet + 10, parameters, accessData.length);
+
+        unsigned short crc = crc_compute(packet, instructionLength + 5);
+        packet[10 + accessData.length] = crc & 0xFF;
+        packet[11 + accessData.length] = (crc >> 8) & 0xFF;
+        return(dynamixelV2::minPacketLength + accessData.length);
+    }
+
+    //! Builds a read frame, returns the frame size
+    static uint8_t makeReadPacket(char* packet, uint8_t id, uint16_t address, uint16_t length)
+    {
+        packet[0] = v2Header[0];
+        packet[1] = v2Header[1];
+        packet[2] = v2Header[2];
+        packet[3] = v2Header[3];
+        packet[dynamixelV2::idPos] = id;
+        packet[dynamixelV2::lengthLSBPos] = 7;
+        packet[dynamixelV2::lengthMSBPos] = 0;
+        packet[dynamixelV2::instructionPos] = dynamixelV2::readInstruction;
+        packet[8] = address & 0xFF;
+        packet[9] = (address >> 8) & 0xFF;
+        packet[10] = length & 0xFF;
+        packet[11] = (length >> 8) & 0xFF;
+
+        unsigned short crc = crc_compute(packet, 12);
+        packet[12] = crc & 0xFF;
+        packet[13] = (crc >> 8) & 0xFF;
+        return(dynamixelV2::minPacketLength + 2);
+    }
+
+    //! Checks a status packet, an answer with the alert bit set is valid
+    static bool decapsulatePacket(const char* packet, bool& alert)
+    {
+        return(checkV2Status(packet, alert));
+    }
+    //!@}
+
+protected:
+
+    const DynamixelManager& manager;
+
+    uint8_t motorID;
+};
+
+//! Type-erased wrapper, giving a DynamixelMotor interface to a statically dispatched motor
+/*!
+ * Lets code written for DynamixelMotor* (DynamixelManager::createMotor(), SyncWrite users...) use a BasicMotor model,
+ * at the usual cost of virtual calls.
+ */
+template<typename Motor>
+class BasicMotorAdapter : public DynamixelMotor {
+
+public:
+
+    BasicMotorAdapter(uint8_t id, const DynamixelPacketSender& dynamixelManager) : DynamixelMotor(id, Motor::model(), dynamixelManager)
+    {}
+
+    DynamixelPacketData* makeWritePacket(DynamixelAccessData accessData, char* parameters) override
+    {
+        uint8_t packetSize = Motor::makeWritePacket(manager.txBuffer, motorID, accessData, parameters);
+        return(new DynamixelPacketData(packetSize, 11));
+    }
+
+    DynamixelPacketData* makeReadPacket(DynamixelAccessData accessData) override
+    {
+        uint16_t address = (uint16_t)(accessData.address[0] | (accessData.address[1] << 8));
+        uint8_t packetSize = Motor::makeReadPacket(manager.txBuffer, motorID, address, accessData.length);
+        return(new DynamixelPacketData(packetSize, 11 + accessData.length));
+    }
+
+    bool decapsulatePacket(const char* packet) override
+    {
+        bool alert;
+        if(!Motor::decapsulatePacket(packet, alert))
+        {
+            return(false);
+        }
+        noteAlert(alert);
+        return(true);
+    }
+
+    bool decapsulatePacket(const char* packet, float& value) override
+    {
+        int intValue = 0;
+        bool status = decapsulatePacket(packet, intValue);
+        value = intValue;
+        return(status);
+    }
+
+    bool decapsulatePacket(const char* packet, int& value) override
+    {
+        if(!decapsulatePacket(packet))
+        {
+            value = 0;
+            return(false);
+        }
+        int parameterLength = (uint8_t)packet[dynamixelV2::lengthLSBPos] + ((uint8_t)packet[dynamixelV2::lengthMSBPos] << 8) - 4;
+        value = decodeLittleEndian(packet + dynamixelV2::responseParameterStart, (uint8_t)parameterLength);
+        return(true);
+    }
+
+protected:
+
+    int32_t fixedAngleToValue(Millidegrees angle, uint8_t length) const override
+    {
+        return(Motor::AngleScale::toValue(angle, length));
+    }
+
+    Millidegrees fixedAngleFromValue(int32_t value) const override
+    {
+        return(Motor::AngleScale::fromValue(value));
+    }
+
+    int32_t fixedVelocityToValue(MilliRpm velocity, uint8_t length) const override
+    {
+        return(Motor::VelocityScale::toValue(velocity, length));
+    }
+
+    MilliRpm fixedVelocityFromValue(int32_t value) const override
+    {
+        return(Motor::VelocityScale::fromValue(value));
+    }
+};
+
+#endif //BASIC_MOTOR_H
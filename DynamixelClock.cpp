@@ -0,0 +1,57 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#include "DynamixelClock.h"
+
+DynamixelClock::DynamixelClock()
+{
+    reset();
+}
+
+void DynamixelClock::reset()
+{
+    milliseconds = 0;
+    lastTick = 0;
+    offset = 0;
+    lastSync = 0;
+    synchronized = false;
+}
+
+bool DynamixelClock::isSynchronized() const
+{
+    return(synchronized);
+}
+
+uint32_t DynamixelClock::synchronize(uint16_t tick, uint32_t sentAt)
+{
+    tick %= DYN_REALTIME_TICK_RANGE;
+    // The tick can not be unwrapped after a full range without reads
+    if(!synchronized || sentAt - lastSync >= (uint32_t)DYN_REALTIME_TICK_RANGE*1000)
+    {
+        milliseconds = 0;
+        offset = sentAt;
+        synchronized = true;
+    }
+    else
+    {
+        milliseconds += (tick - lastTick + DYN_REALTIME_TICK_RANGE) % DYN_REALTIME_TICK_RANGE;
+
+        // Everything is modulo 2^32 like micros(), differences are meaningful as long as they are below 35 minutes
+        uint32_t drift = (uint32_t)((uint64_t)(sentAt - lastSync) * DYN_CLOCK_DRIFT_PPM / 1000000);
+        uint32_t candidate = sentAt - milliseconds*1000;
+        offset += drift;
+        if((int32_t)(candidate - offset) < 0)
+        {
+            offset = candidate;
+        }
+    }
+    lastTick = tick;
+    lastSync = sentAt;
+    return(getLastSample());
+}
+
+uint32_t DynamixelClock::getLastSample() const
+{
+    return(offset + milliseconds*1000);
+}
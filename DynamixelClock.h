@@ -0,0 +1,57 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#ifndef DYNAMIXEL_CLOCK_H
+#define DYNAMIXEL_CLOCK_H
+
+#include "Arduino.h"
+
+#ifndef DYN_REALTIME_TICK_RANGE
+#define DYN_REALTIME_TICK_RANGE 32768   //!< The Realtime Tick register counts milliseconds modulo this value
+#endif
+
+#ifndef DYN_CLOCK_DRIFT_PPM
+#define DYN_CLOCK_DRIFT_PPM 1000        //!< Worst relative drift, in ppm, between a motor clock and micros()
+#endif
+
+//! Offset between the Realtime Tick of a motor and micros()
+/*!
+ * A read of the tick gives the motor time of the sample, up to a millisecond. The tick is unwrapped into a 32 bits
+ * millisecond count, and the offset to micros() is the smallest one seen between the count and the reception of the
+ * answer: the least delayed answer bounds the offset best. The offset is allowed to grow by DYN_CLOCK_DRIFT_PPM, so that
+ * a slower motor clock is followed.
+ * <br>Samples are thus timestamped with the motor clock, free of the bus and scheduling jitter of the receptions.
+ */
+class DynamixelClock {
+
+public:
+
+    DynamixelClock();
+
+    /*!
+     * Feeds a Realtime Tick read and converts it
+     * @param tick Realtime Tick value, in milliseconds
+     * @param sentAt micros() value at which the motor started sending its answer
+     * @return micros() value at which the motor sampled its registers
+     */
+    uint32_t synchronize(uint16_t tick, uint32_t sentAt);
+
+    //! Forgets the offset, e.g. after a reboot of the motor
+    void reset();
+
+    bool isSynchronized() const;
+
+    //! micros() value of the last sample, as returned by synchronize()
+    uint32_t getLastSample() const;
+
+private:
+
+    uint32_t milliseconds;      //!< Unwrapped tick
+    uint16_t lastTick;
+    uint32_t offset;            //!< micros() value when milliseconds was 0, modulo 2^32
+    uint32_t lastSync;
+    bool synchronized;
+};
+
+#endif //DYNAMIXEL_CLOCK_H
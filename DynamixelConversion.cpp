@@ -0,0 +1,148 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#include "DynamixelConversion.h"
+#include "DynamixelRegister.h"
+
+// Vector paths for Linux hosts, the Teensy boards always use the scalar loops.
+// They convert 4 (SSE2, NEON) or 8 (AVX2) values per iteration, the scalar loop handling the remaining ones.
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DYN_SIMD_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DYN_SIMD_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DYN_SIMD_NEON
+#endif
+#endif
+
+void convertToUnits(const char* raw, uint8_t length, float factor, float* units, unsigned int count)
+{
+    unsigned int i = 0;
+#if defined(DYN_SIMD_AVX2)
+    __m256 factors = _mm256_set1_ps(factor);
+    if(length == 4)
+    {
+        for(; i+8 <= count; i += 8)
+        {
+            __m256i values = _mm256_loadu_si256((const __m256i*)(raw + 4*i));
+            _mm256_storeu_ps(units + i, _mm256_mul_ps(_mm256_cvtepi32_ps(values), factors));
+        }
+    }
+    else if(length == 2)
+    {
+        for(; i+8 <= count; i += 8)
+        {
+            __m256i values = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(raw + 2*i)));
+            _mm256_storeu_ps(units + i, _mm256_mul_ps(_mm256_cvtepi32_ps(values), factors));
+        }
+    }
+#elif defined(DYN_SIMD_SSE2)
+    __m128 factors = _mm_set1_ps(factor);
+    if(length == 4)
+    {
+        for(; i+4 <= count; i += 4)
+        {
+            __m128i values = _mm_loadu_si128((const __m128i*)(raw + 4*i));
+            _mm_storeu_ps(units + i, _mm_mul_ps(_mm_cvtepi32_ps(values), factors));
+        }
+    }
+    else if(length == 2)
+    {
+        for(; i+4 <= count; i += 4)
+        {
+            // Sign extension: duplicate each 16 bits value in a 32 bits lane, then shift it back down
+            __m128i values = _mm_loadl_epi64((const __m128i*)(raw + 2*i));
+            values = _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16);
+            _mm_storeu_ps(units + i, _mm_mul_ps(_mm_cvtepi32_ps(values), factors));
+        }
+    }
+#elif defined(DYN_SIMD_NEON)
+    if(length == 4)
+    {
+        for(; i+4 <= count; i += 4)
+        {
+            int32x4_t values = vreinterpretq_s32_u8(vld1q_u8((const uint8_t*)(raw + 4*i)));
+            vst1q_f32(units + i, vmulq_n_f32(vcvtq_f32_s32(values), factor));
+        }
+    }
+    else if(length == 2)
+    {
+        for(; i+4 <= count; i += 4)
+        {
+            int32x4_t values = vmovl_s16(vreinterpret_s16_u8(vld1_u8((const uint8_t*)(raw + 2*i))));
+            vst1q_f32(units + i, vmulq_n_f32(vcvtq_f32_s32(values), factor));
+        }
+    }
+#endif
+    for(; i < count; i++)
+    {
+        units[i] = decodeLittleEndian(raw + length*i, length) * factor;
+    }
+}
+
+void convertToUnits(const int32_t* values, float factor, float* units, unsigned int count)
+{
+    convertToUnits((const char*)values, 4, factor, units, count);
+}
+
+void convertFromUnits(const float* units, float factor, int32_t* values, uint8_t length, unsigned int count)
+{
+    unsigned int i = 0;
+    // The vector conversions round to nearest even with the default rounding mode, like lrintf
+#if defined(DYN_SIMD_AVX2)
+    __m256 factors = _mm256_set1_ps(factor);
+    __m256 lower = _mm256_set1_ps(registerLowerBound(length));
+    __m256 upper = _mm256_set1_ps(registerUpperBound(length));
+    for(; i+8 <= count; i += 8)
+    {
+        __m256 value = _mm256_div_ps(_mm256_loadu_ps(units + i), factors);
+        value = _mm256_min_ps(_mm256_max_ps(value, lower), upper);
+        _mm256_storeu_si256((__m256i*)(values + i), _mm256_cvtps_epi32(value));
+    }
+#elif defined(DYN_SIMD_SSE2)
+    __m128 factors = _mm_set1_ps(factor);
+    __m128 lower = _mm_set1_ps(registerLowerBound(length));
+    __m128 upper = _mm_set1_ps(registerUpperBound(length));
+    for(; i+4 <= count; i += 4)
+    {
+        __m128 value = _mm_div_ps(_mm_loadu_ps(units + i), factors);
+        value = _mm_min_ps(_mm_max_ps(value, lower), upper);
+        _mm_storeu_si128((__m128i*)(values + i), _mm_cvtps_epi32(value));
+    }
+#elif defined(DYN_SIMD_NEON) && defined(__aarch64__)
+    // Division and rounding to nearest are only available on 64 bits ARM
+    float32x4_t factors = vdupq_n_f32(factor);
+    float32x4_t lower = vdupq_n_f32(registerLowerBound(length));
+    float32x4_t upper = vdupq_n_f32(registerUpperBound(length));
+    for(; i+4 <= count; i += 4)
+    {
+        float32x4_t value = vdivq_f32(vld1q_f32(units + i), factors);
+        value = vminq_f32(vmaxq_f32(value, lower), upper);
+        vst1q_s32(values + i, vcvtnq_s32_f32(value));
+    }
+#endif
+    for(; i < count; i++)
+    {
+        values[i] = unitsToValue(units[i], factor, length);
+    }
+}
+
+void convertFromUnits(const float* units, float factor, char* raw, uint8_t length, unsigned int count)
+{
+    // Goes through a small stack buffer: raw data is not aligned, and narrowing is a plain truncation to the low bytes
+    int32_t values[16];
+    for(unsigned int i = 0; i < count; i += 16)
+    {
+        unsigned int chunk = min(count - i, 16u);
+        convertFromUnits(units + i, factor, values, length, chunk);
+        for(unsigned int j = 0; j < chunk; j++)
+        {
+            encodeLittleEndian(raw + length*(i+j), values[j], length);
+        }
+    }
+}
@@ -0,0 +1,61 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#ifndef DYNAMIXEL_CONVERSION_H
+#define DYNAMIXEL_CONVERSION_H
+
+#include "Arduino.h"
+#include <math.h>
+
+/*!
+ * \name Unit conversions
+ * Conversions between raw register values and physical units (degrees, rpm...), the factor being the size of one
+ * register unit (e.g. DynamixelModel::valueToAngle).
+ * <br>Physical units are rounded to the nearest register value, ties to even, and saturate to what a register of the
+ * given length can hold, signed or not. The scalar and batch conversions always give the same wire values.
+ */
+//!@{
+
+//! Lowest value accepted by a register of the given length, as a signed register
+static inline float registerLowerBound(uint8_t length)
+{
+    return(length == 1 ? -128.0f : length == 2 ? -32768.0f : -2147483520.0f);
+}
+
+//! Highest value accepted by a register of the given length, as an unsigned register
+static inline float registerUpperBound(uint8_t length)
+{
+    // Largest float below 2^31 for 4 bytes registers, larger values would overflow the int32_t conversion
+    return(length == 1 ? 255.0f : length == 2 ? 65535.0f : 2147483520.0f);
+}
+
+//! Register value closest to the given physical value
+static inline int32_t unitsToValue(float units, float factor, uint8_t length)
+{
+    float value = units/factor;
+    value = max(value, registerLowerBound(length));
+    value = min(value, registerUpperBound(length));
+    return((int32_t)lrintf(value));
+}
+
+/*!
+ * Converts count raw little endian values, packed one after the other as in SyncRead results, to physical units
+ * @param length register length: 1, 2 or 4 bytes, values are sign-extended
+ */
+void convertToUnits(const char* raw, uint8_t length, float factor, float* units, unsigned int count);
+
+//! Same as convertToUnits(const char*, uint8_t, float, float*, unsigned int) with already decoded values
+void convertToUnits(const int32_t* values, float factor, float* units, unsigned int count);
+
+/*!
+ * Converts count physical values to raw little endian values, packed one after the other as in SyncWrite data
+ * @param length register length: 1, 2 or 4 bytes
+ */
+void convertFromUnits(const float* units, float factor, char* raw, uint8_t length, unsigned int count);
+
+//! Same as convertFromUnits(const float*, float, char*, uint8_t, unsigned int) to values of the given length
+void convertFromUnits(const float* units, float factor, int32_t* values, uint8_t length, unsigned int count);
+//!@}
+
+#endif //DYNAMIXEL_CONVERSION_H
@@ -0,0 +1,86 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#include "DynamixelEstimator.h"
+
+DynamixelEstimator::DynamixelEstimator()
+{
+    reset();
+}
+
+void DynamixelEstimator::reset()
+{
+    position = 0;
+    velocity = 0;
+    residual = 0;
+    velocityError = 0;
+    timestamp = 0;
+    initialized = false;
+}
+
+bool DynamixelEstimator::isInitialized() const
+{
+    return(initialized);
+}
+
+void DynamixelEstimator::update(int32_t measured, uint32_t time)
+{
+    int64_t measuredQ8 = (int64_t)measured << 8;
+    if(!initialized)
+    {
+        position = (int32_t)measuredQ8;
+        velocity = 0;
+        timestamp = time;
+        initialized = true;
+        return;
+    }
+
+    int32_t dt = (int32_t)(time - timestamp);
+    if(dt <= 0)
+    {
+        // Same or older read, only the position is corrected
+        position += (int32_t)(((measuredQ8 - position) * DYN_ESTIMATOR_ALPHA) >> 16);
+        return;
+    }
+
+    int64_t predicted = position + (int64_t)velocity * dt / 1000000;
+    int64_t innovation = measuredQ8 - predicted;
+    int64_t correction = ((innovation * DYN_ESTIMATOR_BETA) >> 16) * 1000000 / dt;
+
+    position = (int32_t)(predicted + ((innovation * DYN_ESTIMATOR_ALPHA) >> 16));
+    velocity = (int32_t)(velocity + correction);
+    timestamp = time;
+
+    // Running averages over about 8 measurements
+    uint32_t absInnovation = (uint32_t)min(innovation < 0 ? -innovation : innovation, (int64_t)0x7FFFFFFF);
+    uint32_t absCorrection = (uint32_t)min(correction < 0 ? -correction : correction, (int64_t)0x7FFFFFFF);
+    residual = residual - (residual >> 3) + (absInnovation >> 3);
+    velocityError = velocityError - (velocityError >> 3) + (absCorrection >> 3);
+}
+
+int32_t DynamixelEstimator::predictPosition(uint32_t now) const
+{
+    int64_t predicted = position + (int64_t)velocity * (int32_t)(now - timestamp) / 1000000;
+    return((int32_t)((predicted + 128) >> 8));
+}
+
+int32_t DynamixelEstimator::getVelocity() const
+{
+    return((velocity + 128) >> 8);
+}
+
+uint32_t DynamixelEstimator::getUncertainty(uint32_t now) const
+{
+    if(!initialized)
+    {
+        return(0xFFFFFFFF);
+    }
+    uint64_t drift = (uint64_t)velocityError * (uint32_t)max((int32_t)(now - timestamp), (int32_t)0) / 1000000;
+    return((uint32_t)min((residual + drift + 255) >> 8, (uint64_t)0xFFFFFFFF));
+}
+
+uint32_t DynamixelEstimator::getTimestamp() const
+{
+    return(timestamp);
+}
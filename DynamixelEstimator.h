@@ -0,0 +1,65 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#ifndef DYNAMIXEL_ESTIMATOR_H
+#define DYNAMIXEL_ESTIMATOR_H
+
+#include "Arduino.h"
+
+#ifndef DYN_ESTIMATOR_ALPHA
+#define DYN_ESTIMATOR_ALPHA 32768   //!< Position gain of the alpha-beta filter, Q16 (0.5)
+#endif
+
+#ifndef DYN_ESTIMATOR_BETA
+#define DYN_ESTIMATOR_BETA 6554     //!< Velocity gain of the alpha-beta filter, Q16 (0.1)
+#endif
+
+//! Alpha-beta filter over the position of a motor
+/*!
+ * Updated with every position read, timestamped, it extrapolates position and velocity at any time without bus
+ * traffic. The uncertainty grows with the age of the last measurement, so that control code or a scheduler can tell
+ * when a real read is worth its bus time.
+ * <br>Integer only: positions and velocities are stored in Q8 raw units (e.g. encoder ticks and ticks per second).
+ */
+class DynamixelEstimator {
+
+public:
+
+    DynamixelEstimator();
+
+    //! Feeds a measured position, timestamp being the micros() value of the read
+    void update(int32_t position, uint32_t timestamp);
+
+    //! Forgets every measurement
+    void reset();
+
+    //! Whether at least one position was measured
+    bool isInitialized() const;
+
+    //! Extrapolated position at the given micros() value
+    int32_t predictPosition(uint32_t now) const;
+
+    //! Estimated velocity, in raw units per second
+    int32_t getVelocity() const;
+
+    /*!
+     * Expected error of predictPosition(now), in raw units: average measurement residual, plus the average velocity
+     * correction integrated over the age of the last measurement
+     */
+    uint32_t getUncertainty(uint32_t now) const;
+
+    //! micros() value of the last measurement
+    uint32_t getTimestamp() const;
+
+private:
+
+    int32_t position;           //!< Q8
+    int32_t velocity;           //!< Q8, per second
+    uint32_t residual;          //!< Q8, running average of |measurement - prediction|
+    uint32_t velocityError;     //!< Q8, running average of |velocity correction|
+    uint32_t timestamp;
+    bool initialized;
+};
+
+#endif //DYNAMIXEL_ESTIMATOR_H
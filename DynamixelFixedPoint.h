@@ -0,0 +1,64 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#ifndef DYNAMIXEL_FIXED_POINT_H
+#define DYNAMIXEL_FIXED_POINT_H
+
+#include "Arduino.h"
+
+/*!
+ * \name Fixed-point conversions
+ * Integer counterparts of the float conversions, for boards without FPU (Teensy LC, 3.2) where each float division
+ * is a software routine. Physical values are scaled integers: angles in millidegrees, velocities in milli-rpm.
+ * <br>Register values are rounded to nearest, ties to even, and saturated to the register range like unitsToValue().
+ * The wire values are the same as the float path for every physical value which is not exactly halfway between two
+ * register values, where the float path rounding depends on the float approximation of the factor.
+ */
+//!@{
+
+typedef int32_t Millidegrees;
+typedef int32_t MilliRpm;
+
+//! Register value closest to units/unitsPerValue, unitsPerValue being positive
+static inline int32_t fixedToValue(int32_t units, int32_t unitsPerValue, uint8_t length)
+{
+    int32_t quotient = units/unitsPerValue;
+    int32_t remainder = units%unitsPerValue;
+    int32_t sign = units < 0 ? -1 : 1;
+    int32_t twiceRemainder = 2*sign*remainder;
+    if(twiceRemainder > unitsPerValue || (twiceRemainder == unitsPerValue && (quotient & 1)))
+    {
+        quotient += sign;
+    }
+
+    int32_t lower = length == 1 ? -128 : length == 2 ? -32768 : INT32_MIN;
+    int32_t upper = length == 1 ? 255 : length == 2 ? 65535 : INT32_MAX;
+    return(quotient < lower ? lower : quotient > upper ? upper : quotient);
+}
+
+//! Physical value of a register value, as a scaled integer
+static inline int32_t fixedFromValue(int32_t value, int32_t unitsPerValue)
+{
+    return(value*unitsPerValue);
+}
+
+//! Compile-time scale, the divisions reduce to multiplications and shifts
+template<int32_t UnitsPerValue>
+struct FixedPointScale {
+    static_assert(UnitsPerValue > 0, "The scale must be positive");
+    static constexpr int32_t unitsPerValue = UnitsPerValue;
+
+    static inline int32_t toValue(int32_t units, uint8_t length)
+    {
+        return(fixedToValue(units, UnitsPerValue, length));
+    }
+
+    static inline int32_t fromValue(int32_t value)
+    {
+        return(value*UnitsPerValue);
+    }
+};
+//!@}
+
+#endif //DYNAMIXEL_FIXED_POINT_H
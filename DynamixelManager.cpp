@@ -3,30 +3,1212 @@
 //
 
 #include "DynamixelManager.h"
+#include "SyncRead.h"
 
 // TODO : Try to generalize for different baudrates and serials
-DynamixelManager::DynamixelManager(HardwareSerial* dynamixelSerial, usb_serial_class* debugSerial = NULL) : serial(dynamixelSerial), debugSerial(debugSerial)
+DynamixelManager::DynamixelManager(HardwareSerial* dynamixelSerial, usb_serial_class* debugSerial, uint32_t baudrate) : serial(dynamixelSerial),
+                                   baudrate(baudrate), returnDelay(500), pendingEcho(0), queuedTransactions(0), telemetryCount(0), nextTelemetry(0), cycleTaskCount(0), debugSerial(debugSerial)
 {
-    txBuffer = new char[30];
-    rxBuffer = new char[30];
+    txBuffer = new char[DYN_BUFFER_SIZE];
+    rxBuffer = new char[DYN_BUFFER_SIZE];
 
-    serial->begin(57600);
+    memset(motorIndices, noMotor, sizeof(motorIndices));
+    motorCount = 0;
+    memset(&jointStates, 0, sizeof(jointStates));
+
+    pollingPolicy = {0, 0, 0, 0};
+    memset(pollPeriods, 0, sizeof(pollPeriods));
+    memset(nextPolls, 0, sizeof(nextPolls));
+
+    memset(hardwareErrorQueued, 0, sizeof(hardwareErrorQueued));
+    hardwareErrorCallback = nullptr;
+    hardwareErrorContext = nullptr;
+
+    memset(presence, MOTOR_PRESENT, sizeof(presence));
+    memset(probeMisses, 0, sizeof(probeMisses));
+    memset(restorePending, 0, sizeof(restorePending));
+    for(DynamixelRestore& restore : restores)
+    {
+        restore.motorIndex = noMotor;
+    }
+    probePeriod = 0;
+    memset(lastProbes, 0, sizeof(lastProbes));
+    nextProbe = 0;
+    nextScan = 0;
+    discoveryCallback = nullptr;
+    discoveryContext = nullptr;
+
+    sheddingPolicy = {0, 3, 50, 4};
+    resetCycleStats();
+
+    serial->begin(baudrate);
+}
+
+DynamixelMotor* DynamixelManager::createMotor(uint8_t id, MotorGeneratorFunctionType generator)
+{
+    if(id >= DYN_ID_SLOTS || motorIndices[id] != noMotor || motorCount >= DYN_MAX_MOTORS)
+    {
+        return nullptr;
+    }
+
+    DynamixelMotor* motor = generator(id, this);
+    if(motor)
+    {
+        motorIndices[id] = motorCount;
+        motors[motorCount] = motor;
+        jointStates.ids[motorCount] = id;
+        pollPeriods[motorCount] = pollingPolicy.minPeriod;
+        nextPolls[motorCount] = micros();
+        presence[motorCount] = MOTOR_PRESENT;
+        probeMisses[motorCount] = 0;
+        restorePending[motorCount] = 0;
+        lastProbes[motorCount] = micros();
+        motorCount++;
+    }
+    return motor;
+}
+
+DynamixelMotor* DynamixelManager::getMotor(uint8_t id) const
+{
+    if(id >= DYN_ID_SLOTS || motorIndices[id] == noMotor)
+    {
+        return nullptr;
+    }
+    return motors[motorIndices[id]];
+}
+
+int DynamixelManager::getMotorIndex(uint8_t id) const
+{
+    if(id >= DYN_ID_SLOTS || motorIndices[id] == noMotor)
+    {
+        return -1;
+    }
+    return motorIndices[id];
+}
+
+bool DynamixelManager::changeMotorID(uint8_t oldId, uint8_t newId)
+{
+    int index = getMotorIndex(oldId);
+    if(index < 0 || newId >= DYN_ID_SLOTS || motorIndices[newId] != noMotor)
+    {
+        return(false);
+    }
+    if(!motors[index]->changeID(newId))
+    {
+        return(false);
+    }
+
+    motorIndices[oldId] = noMotor;
+    motorIndices[newId] = (uint8_t)index;
+    jointStates.ids[index] = newId;
+    for(uint8_t i = 0; i < queuedTransactions; i++)
+    {
+        if(transactionQueue[i].motorID == oldId)
+        {
+            transactionQueue[i].motorID = newId;
+        }
+    }
+    for(uint8_t i = 0; i < telemetryCount; i++)
+    {
+        if(telemetryJobs[i].motorID == oldId)
+        {
+            telemetryJobs[i].motorID = newId;
+        }
+    }
+    return(true);
+}
+
+uint8_t DynamixelManager::getMotorCount() const
+{
+    return motorCount;
+}
+
+DynamixelJointStates& DynamixelManager::getJointStates()
+{
+    return jointStates;
+}
+
+bool DynamixelManager::readJointStates()
+{
+    if(motorCount == 0)
+    {
+        return true;
+    }
+
+    uint16_t start;
+    uint16_t length;
+    jointStateBlock(motors[0]->getModel(), start, length);
+
+    // Only the motors due are part of the SyncRead
+    uint32_t now = micros();
+    uint8_t dueIndices[DYN_MAX_MOTORS];
+    uint8_t dueCount = 0;
+    for(uint8_t i = 0; i < motorCount; i++)
+    {
+        // A parked motor which becomes active, e.g. given a new goal, does not wait for the end of its long period
+        uint32_t lastPoll = nextPolls[i] - pollPeriods[i];
+        if(presence[i] != MOTOR_PRESENT)
+        {
+            continue;
+        }
+        if(pollingPolicy.maxPeriod == 0 || (int32_t)(now - nextPolls[i]) >= 0
+           || (now - lastPoll >= pollingPolicy.minPeriod && isActive(i, now)))
+        {
+            dueIndices[dueCount++] = i;
+        }
+    }
+    if(dueCount == 0)
+    {
+        return true;
+    }
+
+    StaticSyncRead<DYN_MAX_MOTORS> syncRead(*this, dueCount, start, length);
+    for(uint8_t i = 0; i < dueCount; i++)
+    {
+        syncRead.setMotorID(i, jointStates.ids[dueIndices[i]]);
+    }
+    bool status = syncRead.read(&DynamixelManager::storeJointState, this);
+
+    if(pollingPolicy.maxPeriod != 0)
+    {
+        now = micros();
+        for(uint8_t i = 0; i < dueCount; i++)
+        {
+            updatePollPeriod(dueIndices[i], now);
+        }
+    }
+    return status;
+}
+
+void DynamixelManager::setPollingPolicy(const DynamixelPollingPolicy& policy)
+{
+    pollingPolicy = policy;
+
+    // Everybody is polled at the next read, which sets the actual periods
+    uint32_t now = micros();
+    for(uint8_t i = 0; i < motorCount; i++)
+    {
+        pollPeriods[i] = policy.minPeriod;
+        nextPolls[i] = now;
+    }
+}
+
+uint32_t DynamixelManager::getPollPeriod(uint8_t index) const
+{
+    if(index >= motorCount || pollingPolicy.maxPeriod == 0)
+    {
+        return 0;
+    }
+    return pollPeriods[index];
+}
+
+bool DynamixelManager::isActive(uint8_t index, uint32_t now) const
+{
+    if(jointStates.errorFlags[index] != 0)
+    {
+        return true;
+    }
+
+    int32_t velocity = jointStates.presentVelocity[index];
+    if(velocity > pollingPolicy.velocityThreshold || velocity < -pollingPolicy.velocityThreshold)
+    {
+        return true;
+    }
+
+    int32_t distance = jointStates.goalPosition[index] - jointStates.presentPosition[index];
+    if(distance > pollingPolicy.positionThreshold || distance < -pollingPolicy.positionThreshold)
+    {
+        return true;
+    }
+
+    // Catches motors pushed by hand or by a load, or never read yet
+    return motors[index]->getEstimator().getUncertainty(now) > (uint32_t)pollingPolicy.positionThreshold;
+}
+
+void DynamixelManager::updatePollPeriod(uint8_t index, uint32_t now)
+{
+    uint32_t period = pollPeriods[index];
+    if(isActive(index, now))
+    {
+        period = pollingPolicy.minPeriod;
+    }
+    else
+    {
+        // Idle motors slow down progressively, so that a joint stopping for a short while stays responsive
+        period = max(period*2, (uint32_t)DYN_POLL_IDLE_STEP);
+        period = min(period, pollingPolicy.maxPeriod);
+    }
+    pollPeriods[index] = period;
+    nextPolls[index] = now + period;
+}
+
+void DynamixelManager::storeJointState(void* context, uint8_t motorID, bool status, const char* parameters, uint16_t length)
+{
+    DynamixelManager* manager = (DynamixelManager*)context;
+    int index = manager->getMotorIndex(motorID);
+    if(index < 0)
+    {
+        return;
+    }
+
+    DynamixelJointStates& states = manager->jointStates;
+    if(!status)
+    {
+        states.errorFlags[index] |= JOINT_COMMUNICATION_ERROR;
+        return;
+    }
+
+    // Registers are located relatively to the first one of the block
+    DynamixelMotor* motor = manager->motors[index];
+    const DynamixelModel& model = motor->getModel();
+    uint16_t start;
+    uint16_t blockLength;
+    jointStateBlock(model, start, blockLength);
+    uint16_t currentOffset = (uint16_t)(model.currentTorque.address[0] | (model.currentTorque.address[1] << 8)) - start;
+    uint16_t velocityOffset = (uint16_t)(model.currentVelocity.address[0] | (model.currentVelocity.address[1] << 8)) - start;
+    uint16_t positionOffset = (uint16_t)(model.currentAngle.address[0] | (model.currentAngle.address[1] << 8)) - start;
+
+    // The motor clock gives the actual sampling instant, the answer started to be sent one packet time before now
+    uint32_t timestamp = micros();
+    if(model.realtimeTick.length != 0)
+    {
+        uint16_t tickOffset = (uint16_t)(model.realtimeTick.address[0] | (model.realtimeTick.address[1] << 8)) - start;
+        uint32_t sentAt = timestamp - (manager->estimateTransactionTime(0, 11 + length) - manager->returnDelay);
+        timestamp = motor->getClock().synchronize((uint16_t)decodeLittleEndian(parameters + tickOffset, model.realtimeTick.length), sentAt);
+    }
+
+    states.presentCurrent[index] = (int16_t)decodeLittleEndian(parameters + currentOffset, model.currentTorque.length);
+    states.presentVelocity[index] = decodeLittleEndian(parameters + velocityOffset, model.currentVelocity.length);
+    states.presentPosition[index] = decodeLittleEndian(parameters + positionOffset, model.currentAngle.length);
+    states.errorFlags[index] &= ~(JOINT_COMMUNICATION_ERROR | JOINT_HARDWARE_ERROR);
+    if(motor->hasPendingAlert() || motor->getHardwareError() != 0)
+    {
+        states.errorFlags[index] |= JOINT_HARDWARE_ERROR;
+    }
+    states.timestamp[index] = timestamp;
+
+    motor->updateShadow(start, parameters, length, timestamp);
+}
+
+void DynamixelManager::jointStateBlock(const DynamixelModel& model, uint16_t& start, uint16_t& length)
+{
+    start = (uint16_t)(model.currentTorque.address[0] | (model.currentTorque.address[1] << 8));
+    uint16_t end = (uint16_t)(model.currentAngle.address[0] | (model.currentAngle.address[1] << 8)) + model.currentAngle.length;
+    if(model.realtimeTick.length != 0)
+    {
+        start = min(start, (uint16_t)(model.realtimeTick.address[0] | (model.realtimeTick.address[1] << 8)));
+    }
+    length = end - start;
+}
+
+/*
+ *
+ * Health monitoring
+ *
+ */
+
+void DynamixelManager::noteAlert(uint8_t id, bool alert) const
+{
+    DynamixelMotor* motor = getMotor(id);
+    if(motor)
+    {
+        motor->noteAlert(alert);
+    }
+}
+
+void DynamixelManager::setHardwareErrorCallback(HardwareErrorCallbackType* callback, void* context)
+{
+    hardwareErrorCallback = callback;
+    hardwareErrorContext = context;
+}
+
+void DynamixelManager::queueHardwareErrorReads()
+{
+    for(uint8_t i = 0; i < motorCount; i++)
+    {
+        if(!motors[i]->hasPendingAlert() || hardwareErrorQueued[i] || presence[i] != MOTOR_PRESENT)
+        {
+            continue;
+        }
+        const DynamixelAccessData& access = motors[i]->getModel().hardwareError;
+        if(access.length != 0 && queueRead(jointStates.ids[i], access, BACKGROUND_PRIORITY,
+                                           &DynamixelManager::storeHardwareError, this))
+        {
+            hardwareErrorQueued[i] = true;
+        }
+    }
+}
+
+void DynamixelManager::storeHardwareError(void* context, uint8_t motorID, bool status, const char* parameters, uint16_t)
+{
+    DynamixelManager* manager = (DynamixelManager*)context;
+    int index = manager->getMotorIndex(motorID);
+    if(index < 0)
+    {
+        return;
+    }
+
+    // On failure the alert stays pending, the read is queued again at the next cycle
+    manager->hardwareErrorQueued[index] = false;
+    if(!status)
+    {
+        return;
+    }
+
+    uint8_t error = (uint8_t)parameters[0];
+    manager->motors[index]->setHardwareError(error);
+    if(error != 0 && manager->hardwareErrorCallback)
+    {
+        manager->hardwareErrorCallback(manager->hardwareErrorContext, motorID, error);
+    }
+}
+
+/*
+ *
+ * Hot-plug
+ *
+ */
+
+bool DynamixelManager::ping(uint8_t id) const
+{
+    uint8_t packetSize = dynamixelV2::minPacketLength - 2;
+    uint8_t responseSize = dynamixelV2::minPacketLength + 2;
+    unsigned int position = 0;
+    for(unsigned char headerPart : v2Header)
+    {
+        txBuffer[position++] = headerPart;
+    }
+    txBuffer[position++] = id;
+    txBuffer[position++] = 3;
+    txBuffer[position++] = 0;
+    txBuffer[position++] = dynamixelV2::pingInstruction;
+    unsigned short crc = crc_compute(txBuffer, packetSize-2);
+    txBuffer[position++] = crc & 0xFF;
+    txBuffer[position++] = (crc >> 8) & 0xFF;
+
+    // The answer is waited for with a deadline, a missing motor must not cost the serial timeout
+    sendFrame(packetSize, 0);
+    uint8_t received;
+    char* response = readPacketBefore(responseSize, micros() + estimateTransactionTime(0, responseSize) + DYN_READ_MARGIN, received);
+    if(received < responseSize || (uint8_t)response[dynamixelV2::idPos] != id)
+    {
+        return false;
+    }
+
+    bool alert;
+    if(!checkV2Status(response, alert))
+    {
+        return false;
+    }
+    noteAlert(id, alert);
+    return true;
+}
+
+void DynamixelManager::setProbePeriod(uint32_t period)
+{
+    probePeriod = period;
+}
+
+bool DynamixelManager::isPresent(uint8_t id) const
+{
+    int index = getMotorIndex(id);
+    return index >= 0 && presence[index] == MOTOR_PRESENT;
+}
+
+void DynamixelManager::setDiscoveryCallback(MotorDiscoveryCallbackType* callback, void* context)
+{
+    discoveryCallback = callback;
+    discoveryContext = context;
+}
+
+void DynamixelManager::probeMotors(uint32_t cycleDeadline)
+{
+    if(probePeriod == 0)
+    {
+        return;
+    }
+
+    // Restores which did not fit in the queue go on where they stopped
+    for(DynamixelRestore& restore : restores)
+    {
+        if(restore.motorIndex != noMotor && presence[restore.motorIndex] != MOTOR_RESTORING)
+        {
+            restore.motorIndex = noMotor;
+        }
+        else if(restore.motorIndex != noMotor)
+        {
+            restoreConfiguration(restore);
+        }
+    }
+
+    uint32_t duration = estimateTransactionTime(dynamixelV2::minPacketLength - 2, dynamixelV2::minPacketLength + 2) + DYN_READ_MARGIN;
+    uint8_t probed = 0;
+    for(uint8_t i = 0; i < motorCount && probed < DYN_PROBE_BATCH; i++)
+    {
+        uint8_t index = (nextProbe + i) % motorCount;
+        if(micros() - lastProbes[index] < probePeriod)
+        {
+            continue;
+        }
+        if(!fitsBefore(cycleDeadline, duration))
+        {
+            return;
+        }
+
+        bool answered = ping(jointStates.ids[index]);
+        lastProbes[index] = micros();
+        probed++;
+        nextProbe = (index + 1) % motorCount;
+
+        if(!answered)
+        {
+            // A single lost answer is not an unplugged motor
+            if(probeMisses[index] < DYN_PROBE_MISSES)
+            {
+                probeMisses[index]++;
+            }
+            if(probeMisses[index] >= DYN_PROBE_MISSES)
+            {
+                presence[index] = MOTOR_MISSING;
+            }
+            continue;
+        }
+
+        probeMisses[index] = 0;
+        // Writes of an interrupted restore must all be answered before starting over, or their callbacks would mix
+        if(presence[index] == MOTOR_MISSING && restorePending[index] == 0 && startRestore(index))
+        {
+            // The motor may have been power-cycled: its clock restarted and its RAM lost everything
+            motors[index]->getClock().reset();
+        }
+    }
+
+    if(probed < DYN_PROBE_BATCH)
+    {
+        scanUnregistered(cycleDeadline);
+    }
+}
+
+void DynamixelManager::scanUnregistered(uint32_t cycleDeadline)
+{
+    if(!discoveryCallback)
+    {
+        return;
+    }
+
+    uint32_t duration = estimateTransactionTime(dynamixelV2::minPacketLength - 2, dynamixelV2::minPacketLength + 2) + DYN_READ_MARGIN;
+    for(uint8_t i = 0; i < DYN_ID_SLOTS; i++)
+    {
+        uint8_t id = nextScan;
+        nextScan = (uint8_t)((nextScan + 1) % DYN_ID_SLOTS);
+        if(motorIndices[id] != noMotor)
+        {
+            continue;
+        }
+        if(fitsBefore(cycleDeadline, duration) && ping(id))
+        {
+            discoveryCallback(discoveryContext, id);
+        }
+        return;
+    }
+}
+
+bool DynamixelManager::startRestore(uint8_t index)
+{
+    DynamixelRestore* restore = nullptr;
+    for(DynamixelRestore& slot : restores)
+    {
+        if(slot.motorIndex == noMotor)
+        {
+            restore = &slot;
+            break;
+        }
+    }
+    if(!restore)
+    {
+        return false;
+    }
+
+    DynamixelMotor* motor = motors[index];
+    const DynamixelModel& model = motor->getModel();
+    const DynamixelShadow& shadow = motor->getShadow();
+    DynamixelRestoreStep* steps = restore->steps;
+    uint8_t stepCount = 0;
+    uint16_t torqueAddress = (uint16_t)(model.torqueEnable.address[0] | (model.torqueEnable.address[1] << 8));
+
+    // Operating mode first, it is in EEPROM and can only be written with the torque off. A motor which was only
+    // disconnected, not power-cycled, still has its torque on.
+    uint8_t mode;
+    if(motor->getCachedOperatingMode(mode))
+    {
+        steps[stepCount++] = {torqueAddress, model.torqueEnable.length, false, 0};
+        steps[stepCount++] = {(uint16_t)(model.operatingMode.address[0] | (model.operatingMode.address[1] << 8)),
+                              model.operatingMode.length, false, mode};
+    }
+
+    // Every known value that can safely be re-written, by runs of whole fields, torque excepted
+    const DynamixelShadowLayout* layout = shadow.getLayout();
+    if(layout)
+    {
+        uint16_t end = layout->startAddress + layout->length;
+        uint16_t address = layout->startAddress;
+        while(address < end && stepCount < DYN_RESTORE_STEPS - 1)
+        {
+            uint16_t runStart = address;
+            uint8_t runLength = 0;
+            while(address < end && shadow.canFill(address, 1)
+                  && (address < torqueAddress || address >= torqueAddress + model.torqueEnable.length))
+            {
+                uint8_t field = layout->byteFields[address - layout->startAddress];
+                uint16_t fieldEnd = address;
+                while(fieldEnd < end && layout->byteFields[fieldEnd - layout->startAddress] == field)
+                {
+                    fieldEnd++;
+                }
+                if(runLength + (fieldEnd - address) > DYN_TRANSACTION_DATA_SIZE)
+                {
+                    break;
+                }
+                runLength += fieldEnd - address;
+                address = fieldEnd;
+            }
+
+            if(runLength == 0)
+            {
+                address++;
+                continue;
+            }
+            steps[stepCount++] = {runStart, runLength, true, 0};
+        }
+    }
+
+    // Torque last, once the motor is configured, with its value from before the torque off step
+    if(shadow.isKnown(torqueAddress, model.torqueEnable.length))
+    {
+        steps[stepCount++] = {torqueAddress, model.torqueEnable.length, false, (uint8_t)*shadow.data(torqueAddress)};
+    }
+
+    if(stepCount == 0)
+    {
+        presence[index] = MOTOR_PRESENT;
+        jointStates.errorFlags[index] = 0;
+        nextPolls[index] = micros();
+        return true;
+    }
+
+    restore->motorIndex = index;
+    restore->stepCount = stepCount;
+    restore->queuedSteps = 0;
+    presence[index] = MOTOR_RESTORING;
+    restoreConfiguration(*restore);
+    return true;
+}
+
+bool DynamixelManager::restoreConfiguration(DynamixelRestore& restore)
+{
+    uint8_t index = restore.motorIndex;
+    uint8_t id = jointStates.ids[index];
+    const DynamixelShadow& shadow = motors[index]->getShadow();
+
+    // Only the answer to the last write tells that the whole configuration is back
+    while(restore.queuedSteps < restore.stepCount)
+    {
+        const DynamixelRestoreStep& step = restore.steps[restore.queuedSteps];
+        DynamixelAccessData access((uint8_t)(step.address & 0xFF), (uint8_t)(step.address >> 8), step.length);
+        const char* data = step.fromShadow ? shadow.data(step.address) : (const char*)&step.value;
+        bool last = restore.queuedSteps == restore.stepCount - 1;
+        if(!queueWrite(id, access, data, BACKGROUND_PRIORITY, last ? restoreDone : restoreStepDone, this))
+        {
+            return false;
+        }
+        restore.queuedSteps++;
+        restorePending[index]++;
+    }
+    return true;
+}
+
+void DynamixelManager::endRestore(uint8_t index)
+{
+    for(DynamixelRestore& restore : restores)
+    {
+        if(restore.motorIndex == index)
+        {
+            restore.motorIndex = noMotor;
+        }
+    }
+}
+
+void DynamixelManager::restoreStepDone(void* manager, uint8_t motorID, bool status, const char*, uint16_t)
+{
+    DynamixelManager* self = (DynamixelManager*)manager;
+    int index = self->getMotorIndex(motorID);
+    if(index < 0)
+    {
+        return;
+    }
+    self->restorePending[index]--;
+    if(!status)
+    {
+        // Gone again: the remaining writes fail without being sent, before the next restore starts
+        self->presence[index] = MOTOR_MISSING;
+        self->endRestore(index);
+    }
+}
+
+void DynamixelManager::restoreDone(void* manager, uint8_t motorID, bool status, const char*, uint16_t)
+{
+    DynamixelManager* self = (DynamixelManager*)manager;
+    int index = self->getMotorIndex(motorID);
+    if(index < 0)
+    {
+        return;
+    }
+    self->restorePending[index]--;
+    self->endRestore(index);
+    if(!status)
+    {
+        self->presence[index] = MOTOR_MISSING;
+    }
+    else if(self->presence[index] == MOTOR_RESTORING)
+    {
+        self->presence[index] = MOTOR_PRESENT;
+        self->jointStates.errorFlags[index] = 0;
+        self->nextPolls[index] = micros();
+    }
+}
+
+/*
+ *
+ * Transaction queue
+ *
+ */
+
+bool DynamixelManager::queueWrite(uint8_t id, const DynamixelAccessData& accessData, const char* data,
+                                  TransactionPriority priority, TransactionCallbackType* callback, void* context)
+{
+    if(accessData.length > DYN_TRANSACTION_DATA_SIZE)
+    {
+        return(false);
+    }
+
+    DynamixelTransaction transaction;
+    transaction.motorID = id;
+    transaction.priority = priority;
+    transaction.isWrite = true;
+    transaction.address = (uint16_t)(accessData.address[0] | (accessData.address[1] << 8));
+    transaction.length = accessData.length;
+    memcpy(transaction.data, data, accessData.length);
+    transaction.segments[0] = {transaction.address, transaction.length, callback, context};
+    transaction.segmentCount = 1;
+    return(enqueueTransaction(transaction));
+}
+
+bool DynamixelManager::queueRead(uint8_t id, const DynamixelAccessData& accessData, TransactionPriority priority,
+                                 TransactionCallbackType* callback, void* context)
+{
+    // The status packet adds 11 bytes to the data
+    if(11 + accessData.length > DYN_BUFFER_SIZE)
+    {
+        return(false);
+    }
+
+    DynamixelTransaction transaction;
+    transaction.motorID = id;
+    transaction.priority = priority;
+    transaction.isWrite = false;
+    transaction.address = (uint16_t)(accessData.address[0] | (accessData.address[1] << 8));
+    transaction.length = accessData.length;
+    transaction.segments[0] = {transaction.address, transaction.length, callback, context};
+    transaction.segmentCount = 1;
+    return(enqueueTransaction(transaction));
+}
+
+int DynamixelManager::addTelemetry(uint8_t id, const DynamixelAccessData& accessData, uint32_t period,
+                                   TransactionCallbackType* callback, void* context)
+{
+    if(telemetryCount >= DYN_MAX_TELEMETRY || 11 + accessData.length > DYN_BUFFER_SIZE)
+    {
+        return(-1);
+    }
+
+    DynamixelTelemetryJob& job = telemetryJobs[telemetryCount];
+    job.motorID = id;
+    job.address = (uint16_t)(accessData.address[0] | (accessData.address[1] << 8));
+    job.length = accessData.length;
+    job.period = period;
+    job.nextDue = micros();
+    job.callback = callback;
+    job.context = context;
+    return(telemetryCount++);
+}
+
+void DynamixelManager::processQueue(uint32_t cycleDeadline)
+{
+    // Control tasks first, whatever the deadline
+    for(uint8_t task = 0; task < cycleTaskCount; task++)
+    {
+        cycleTasks[task](cycleTaskContexts[task]);
+    }
+
+    // Control transactions are sent whatever the deadline, in queue order
+    uint8_t index = 0;
+    while(index < queuedTransactions)
+    {
+        if(transactionQueue[index].priority == CONTROL_PRIORITY)
+        {
+            // Copied as the callback may queue new transactions
+            DynamixelTransaction transaction = transactionQueue[index];
+            removeTransaction(index);
+            executeTransaction(transaction);
+        }
+        else
+        {
+            index++;
+        }
+    }
+
+    queueHardwareErrorReads();
+
+    // Background one-shot transactions, in order, as long as they fit in the slack
+    while(queuedTransactions > 0)
+    {
+        DynamixelTransaction& next = transactionQueue[0];
+        if(!next.isWrite && isShedding(SHED_OPTIONAL_READS))
+        {
+            DynamixelTransaction transaction = next;
+            removeTransaction(0);
+            cycleStats.droppedTransactions++;
+            notifyTransaction(transaction, false, nullptr);
+            continue;
+        }
+
+        if(!isReachable(next))
+        {
+            DynamixelTransaction transaction = next;
+            removeTransaction(0);
+            notifyTransaction(transaction, false, nullptr);
+            continue;
+        }
+
+        uint32_t duration = next.isWrite ? estimateTransactionTime(dynamixelV2::minPacketLength + next.length, 11)
+                                         : estimateTransactionTime(dynamixelV2::minPacketLength + 2, 11 + next.length);
+        // A shorter telemetry job or probe may still fit
+        if(!fitsBefore(cycleDeadline, duration))
+        {
+            break;
+        }
+        DynamixelTransaction transaction = next;
+        removeTransaction(0);
+        executeTransaction(transaction);
+    }
+
+    // Periodic telemetry, round-robin so that every job eventually gets its turn
+    uint8_t firstSkipped = telemetryCount;
+    for(uint8_t i = 0; i < telemetryCount; i++)
+    {
+        uint8_t jobIndex = (nextTelemetry + i) % telemetryCount;
+        DynamixelTelemetryJob& job = telemetryJobs[jobIndex];
+        int motorIndex = getMotorIndex(job.motorID);
+        if((int32_t)(micros() - job.nextDue) < 0 || (motorIndex >= 0 && presence[motorIndex] != MOTOR_PRESENT))
+        {
+            continue;
+        }
+
+        if(!fitsBefore(cycleDeadline, estimateTransactionTime(dynamixelV2::minPacketLength + 2, 11 + job.length)))
+        {
+            if(firstSkipped == telemetryCount)
+            {
+                firstSkipped = jobIndex;
+            }
+            continue;
+        }
+
+        DynamixelTransaction transaction;
+        transaction.motorID = job.motorID;
+        transaction.priority = BACKGROUND_PRIORITY;
+        transaction.isWrite = false;
+        transaction.address = job.address;
+        transaction.length = job.length;
+        transaction.segments[0] = {job.address, job.length, job.callback, job.context};
+        transaction.segmentCount = 1;
+        job.nextDue = micros() + job.period * (isShedding(SHED_TELEMETRY_RATE) ? sheddingPolicy.telemetryDivider : 1);
+        executeTransaction(transaction);
+    }
+    if(firstSkipped != telemetryCount)
+    {
+        nextTelemetry = firstSkipped;
+    }
+
+    probeMotors(cycleDeadline);
 }
 
-DynamixelMotor* DynamixelManager::createMotor(uint8_t id, MotorGeneratorFunctionType generator)
+uint32_t DynamixelManager::estimateTransactionTime(uint16_t sentBytes, uint16_t receivedBytes) const
 {
-    DynamixelMotor* motor = generator(id, this);
-    motorMap.insert({id, motor});
-    return motor;
+    // 10 bits per byte on the wire (start + 8 data + stop)
+    return((uint32_t)(((uint64_t)(sentBytes + receivedBytes) * 10 * 1000000) / baudrate) + returnDelay);
+}
+
+void DynamixelManager::setReturnDelay(uint32_t delay)
+{
+    returnDelay = delay;
+}
+
+/*
+ *
+ * Control cycle accounting
+ *
+ */
+
+void DynamixelManager::beginCycle(uint32_t period)
+{
+    cycleStats.lastStart = micros();
+    cycleStats.lastDeadline = cycleStats.lastStart + period;
+}
+
+void DynamixelManager::endCycle()
+{
+    processQueue(cycleStats.lastDeadline);
+
+    cycleStats.lastEnd = micros();
+    cycleStats.cycleCount++;
+    cycleStats.lastDuration = cycleStats.lastEnd - cycleStats.lastStart;
+    if(cycleStats.lastDuration > cycleStats.worstDuration)
+    {
+        cycleStats.worstDuration = cycleStats.lastDuration;
+    }
+
+    int32_t overrun = (int32_t)(cycleStats.lastEnd - cycleStats.lastDeadline);
+    if(overrun > 0)
+    {
+        cycleStats.deadlineMisses++;
+        cycleStats.consecutiveMisses++;
+        cycleStats.consecutiveOnTime = 0;
+        if((uint32_t)overrun > cycleStats.worstOverrun)
+        {
+            cycleStats.worstOverrun = (uint32_t)overrun;
+        }
+    }
+    else
+    {
+        cycleStats.consecutiveMisses = 0;
+        cycleStats.consecutiveOnTime++;
+    }
+
+    if(!shedding && sheddingPolicy.actions && cycleStats.consecutiveMisses >= sheddingPolicy.missThreshold)
+    {
+        shedding = true;
+#ifdef DYN_VERBOSE
+        if(debugSerial) {
+            debugSerial->printf("[Dynamixel-Com] %i deadline misses in a row, shedding load\n", cycleStats.consecutiveMisses);
+        }
+#endif
+    }
+    else if(shedding && cycleStats.consecutiveOnTime >= sheddingPolicy.recoveryThreshold)
+    {
+        shedding = false;
+    }
+
+    if(shedding)
+    {
+        cycleStats.shedCycles++;
+    }
+}
+
+bool DynamixelManager::addCycleTask(CycleTaskType* task, void* context)
+{
+    if(cycleTaskCount >= DYN_MAX_CYCLE_TASKS)
+    {
+        return(false);
+    }
+    cycleTasks[cycleTaskCount] = task;
+    cycleTaskContexts[cycleTaskCount] = context;
+    cycleTaskCount++;
+    return(true);
+}
+
+void DynamixelManager::removeCycleTask(CycleTaskType* task, void* context)
+{
+    for(uint8_t i = 0; i < cycleTaskCount; i++)
+    {
+        if(cycleTasks[i] == task && cycleTaskContexts[i] == context)
+        {
+            memmove(cycleTasks + i, cycleTasks + i + 1, (cycleTaskCount - i - 1)*sizeof(CycleTaskType*));
+            memmove(cycleTaskContexts + i, cycleTaskContexts + i + 1, (cycleTaskCount - i - 1)*sizeof(void*));
+            cycleTaskCount--;
+            return;
+        }
+    }
+}
+
+uint32_t DynamixelManager::getCycleDeadline() const
+{
+    return(cycleStats.lastDeadline);
+}
+
+void DynamixelManager::setSheddingPolicy(const DynamixelSheddingPolicy& policy)
+{
+    sheddingPolicy = policy;
+    if(!policy.actions)
+    {
+        shedding = false;
+    }
+}
+
+const DynamixelCycleStats& DynamixelManager::getCycleStats() const
+{
+    return(cycleStats);
+}
+
+void DynamixelManager::resetCycleStats()
+{
+    memset(&cycleStats, 0, sizeof(cycleStats));
+    shedding = false;
+}
+
+bool DynamixelManager::isShedding() const
+{
+    return(shedding);
+}
+
+bool DynamixelManager::isShedding(SheddingActions action) const
+{
+    return(shedding && (sheddingPolicy.actions & action));
+}
+
+bool DynamixelManager::useFastSyncRead() const
+{
+    return(isShedding(SHED_FAST_SYNC_READ));
+}
+
+void DynamixelManager::executeTransaction(DynamixelTransaction& transaction)
+{
+    DynamixelMotor* motor = getMotor(transaction.motorID);
+    if(!motor || !isReachable(transaction))
+    {
+        notifyTransaction(transaction, false, nullptr);
+        return;
+    }
+
+    DynamixelAccessData accessData((uint8_t)(transaction.address & 0xFF), (uint8_t)(transaction.address >> 8),
+                                   (uint8_t)transaction.length);
+    DynamixelPacketData* packet;
+    if(transaction.isWrite)
+    {
+        if(transaction.segmentCount > 1)
+        {
+            fillWriteGaps(transaction, motor->getShadow());
+        }
+        packet = motor->makeWritePacket(accessData, transaction.data);
+    }
+    else
+    {
+        packet = motor->makeReadPacket(accessData);
+    }
+    uint8_t responseSize = packet->responseSize;
+    sendFrame(packet->dataSize, 0);
+    delete packet;
+
+    // A motor which does not answer costs its answer time, not the serial timeout
+    uint8_t received;
+    char* returnPacket = readPacketBefore(responseSize, micros() + estimateTransactionTime(0, responseSize) + DYN_READ_MARGIN, received);
+    bool status = received == responseSize && motor->decapsulatePacket(returnPacket);
+
+    const char* values = transaction.isWrite ? transaction.data : returnPacket + dynamixelV2::responseParameterStart;
+    if(status)
+    {
+        motor->updateShadow(transaction.address, values, transaction.length);
+    }
+    notifyTransaction(transaction, status, transaction.isWrite ? nullptr : values);
+}
+
+bool DynamixelManager::isReachable(const DynamixelTransaction& transaction) const
+{
+    int index = getMotorIndex(transaction.motorID);
+    if(index < 0 || presence[index] == MOTOR_PRESENT)
+    {
+        return(true);
+    }
+
+    // Only the restore writes of a motor which answered again may go through
+    if(presence[index] != MOTOR_RESTORING)
+    {
+        return(false);
+    }
+    for(uint8_t i = 0; i < transaction.segmentCount; i++)
+    {
+        TransactionCallbackType* callback = transaction.segments[i].callback;
+        if(callback == &DynamixelManager::restoreStepDone || callback == &DynamixelManager::restoreDone)
+        {
+            return(true);
+        }
+    }
+    return(false);
+}
+
+void DynamixelManager::fillWriteGaps(DynamixelTransaction& transaction, const DynamixelShadow& shadow) const
+{
+    bool requested[DYN_TRANSACTION_DATA_SIZE] = {false};
+    for(uint8_t i = 0; i < transaction.segmentCount; i++)
+    {
+        const DynamixelTransactionSegment& segment = transaction.segments[i];
+        memset(requested + (segment.address - transaction.address), true, segment.length);
+    }
+
+    for(uint16_t i = 0; i < transaction.length; i++)
+    {
+        if(!requested[i])
+        {
+            transaction.data[i] = *shadow.data(transaction.address + i);
+        }
+    }
+}
+
+bool DynamixelManager::refreshShadows(const uint8_t* ids, uint8_t count)
+{
+    if(count == 0)
+    {
+        return(true);
+    }
+    if(count > DYN_MAX_MOTORS)
+    {
+        return(false);
+    }
+
+    DynamixelMotor* motor = getMotor(ids[0]);
+    if(!motor || !motor->getShadow().getLayout())
+    {
+        return(false);
+    }
+
+    const DynamixelShadowLayout* layout = motor->getShadow().getLayout();
+    StaticSyncRead<DYN_MAX_MOTORS> syncRead(*this, count, layout->startAddress, layout->length);
+    for(uint8_t i = 0; i < count; i++)
+    {
+        syncRead.setMotorID(i, ids[i]);
+    }
+    return(syncRead.read(&DynamixelManager::storeShadow, this));
+}
+
+void DynamixelManager::storeShadow(void* manager, uint8_t motorID, bool status, const char* parameters, uint16_t length)
+{
+    if(!status)
+    {
+        return;
+    }
+
+    DynamixelMotor* motor = ((DynamixelManager*)manager)->getMotor(motorID);
+    if(motor && motor->getShadow().getLayout())
+    {
+        motor->updateShadow(motor->getShadow().getLayout()->startAddress, parameters, length);
+    }
+}
+
+void DynamixelManager::notifyTransaction(const DynamixelTransaction& transaction, bool status, const char* parameters) const
+{
+    for(uint8_t i = 0; i < transaction.segmentCount; i++)
+    {
+        const DynamixelTransactionSegment& segment = transaction.segments[i];
+        if(segment.callback)
+        {
+            const char* segmentParameters = parameters ? parameters + (segment.address - transaction.address) : nullptr;
+            segment.callback(segment.context, transaction.motorID, status, segmentParameters, segment.length);
+        }
+    }
+}
+
+bool DynamixelManager::enqueueTransaction(const DynamixelTransaction& transaction)
+{
+    // Only the last transaction queued for this motor is a merge candidate, so that accesses to a motor keep their order
+    for(int i = queuedTransactions - 1; i >= 0; i--)
+    {
+        if(transactionQueue[i].motorID == transaction.motorID)
+        {
+            if(mergeTransaction(transactionQueue[i], transaction))
+            {
+                return(true);
+            }
+            break;
+        }
+    }
+
+    if(queuedTransactions >= DYN_QUEUE_SIZE)
+    {
+        return(false);
+    }
+    transactionQueue[queuedTransactions++] = transaction;
+    return(true);
+}
+
+bool DynamixelManager::mergeTransaction(DynamixelTransaction& queued, const DynamixelTransaction& incoming) const
+{
+    if(queued.isWrite != incoming.isWrite || queued.segmentCount >= DYN_MAX_MERGED)
+    {
+        return(false);
+    }
+
+    uint16_t queuedEnd = queued.address + queued.length;
+    uint16_t incomingEnd = incoming.address + incoming.length;
+    uint16_t start = min(queued.address, incoming.address);
+    uint16_t end = max(queuedEnd, incomingEnd);
+
+    // Reads may span a few unrequested bytes. Every byte of a write range gets written, so gaps in a write are only
+    // allowed if the motor shadow knows their current value and they are safe to re-write.
+    if(incoming.address > queuedEnd + DYN_MERGE_GAP || queued.address > incomingEnd + DYN_MERGE_GAP)
+    {
+        return(false);
+    }
+    uint16_t gapStart = min(queuedEnd, incomingEnd);
+    uint16_t gapEnd = max(queued.address, incoming.address);
+    if(queued.isWrite && gapEnd > gapStart)
+    {
+        DynamixelMotor* motor = getMotor(queued.motorID);
+        if(!motor || !motor->getShadow().canFill(gapStart, gapEnd - gapStart))
+        {
+            return(false);
+        }
+    }
+    if(queued.isWrite && end - start > DYN_TRANSACTION_DATA_SIZE)
+    {
+        return(false);
+    }
+    if(!queued.isWrite && 11 + end - start > DYN_BUFFER_SIZE)
+    {
+        return(false);
+    }
+
+    if(queued.isWrite)
+    {
+        char data[DYN_TRANSACTION_DATA_SIZE];
+        memcpy(data + (queued.address - start), queued.data, queued.length);
+        // The incoming write is the most recent one, it wins where they overlap
+        memcpy(data + (incoming.address - start), incoming.data, incoming.length);
+        memcpy(queued.data, data, end - start);
+    }
+
+    queued.address = start;
+    queued.length = end - start;
+    queued.priority = min(queued.priority, incoming.priority);
+    queued.segments[queued.segmentCount++] = incoming.segments[0];
+    return(true);
+}
+
+void DynamixelManager::removeTransaction(uint8_t index)
+{
+    for(uint8_t i = index; i + 1 < queuedTransactions; i++)
+    {
+        transactionQueue[i] = transactionQueue[i+1];
+    }
+    queuedTransactions--;
 }
 
-DynamixelMotor* DynamixelManager::getMotor(uint8_t id)
+bool DynamixelManager::fitsBefore(uint32_t deadline, uint32_t duration) const
 {
-    return motorMap.at(id);
+    return((int32_t)(deadline - (micros() + duration)) >= 0);
 }
 
 char* DynamixelManager::readPacket(uint8_t responseSize) const
 {
+    responseSize = min(responseSize, (uint8_t)DYN_BUFFER_SIZE);
     memset(rxBuffer, 0, responseSize);
 
     if(responseSize == 0 )
@@ -60,15 +1242,98 @@ char* DynamixelManager::readPacket(uint8_t responseSize) const
 
 }
 
+void DynamixelManager::sendFrameAsync(const char* frame, uint8_t size) const
+{
+    drainEcho();
+    flushInput();
+    serial->write(frame,size);
+    pendingEcho = size;
+}
+
+void DynamixelManager::drainEcho() const
+{
+    if(pendingEcho == 0)
+    {
+        return;
+    }
+
+    // The echo only lands in rxBuffer, which is always overwritten before being read
+    for(uint16_t drained = 0; drained < pendingEcho; drained += DYN_BUFFER_SIZE)
+    {
+        serial->readBytes(rxBuffer,min(pendingEcho - drained, DYN_BUFFER_SIZE));
+    }
+#ifdef DYN_VERBOSE
+    if(debugSerial) {
+        debugSerial->printf("Drained echo (%i)\n",pendingEcho);
+    }
+#endif
+    pendingEcho = 0;
+}
+
+void DynamixelManager::flushInput() const
+{
+    while(serial->available() > 0)
+    {
+        serial->read();
+    }
+}
+
+char* DynamixelManager::readPacketBefore(uint8_t responseSize, uint32_t deadline, uint8_t& received) const
+{
+    responseSize = min(responseSize, (uint8_t)DYN_BUFFER_SIZE);
+    received = 0;
+    while(received < responseSize)
+    {
+        if(serial->available() > 0)
+        {
+            char byte = (char)serial->read();
+            if(received < sizeof(v2Header) && (unsigned char)byte != v2Header[received])
+            {
+                // Skips the remains of a late or broken answer until the next header, keeping the 0xFF already matched
+                unsigned char expected = v2Header[received];
+                received = ((unsigned char)byte != 0xFF) ? 0 : (expected == 0xFD ? 2 : 1);
+                memset(rxBuffer, 0xFF, received);
+                continue;
+            }
+            rxBuffer[received++] = byte;
+        }
+        else if((int32_t)(micros() - deadline) >= 0)
+        {
+#ifdef DYN_VERBOSE
+            if(debugSerial) {
+                debugSerial->printf("[Dynamixel-Com] Deadline passed (received %i of %i)\n", received, responseSize);
+            }
+#endif
+            break;
+        }
+    }
+    return(rxBuffer);
+}
+
 char* DynamixelManager::sendPacket(DynamixelPacketData* packet) const
 {
-    debugSerial->printf("Available for writing is %i\n", serial->availableForWrite());
-    serial->write(txBuffer,packet->dataSize);       // Sends buffered packet
+    uint8_t dataSize = packet->dataSize;
+    uint8_t responseSize = packet->responseSize;
+    delete packet;
+
+    return sendFrame(dataSize, responseSize);
+}
+
+char* DynamixelManager::sendFrame(uint8_t dataSize, uint8_t responseSize) const
+{
+#ifdef DYN_VERBOSE
+    if(debugSerial) {
+        debugSerial->printf("Available for writing is %i\n", serial->availableForWrite());
+    }
+#endif
+    drainEcho();
+    flushInput();                                   // Late answers must not be mistaken for the echo
+    serial->write(txBuffer,dataSize);               // Sends buffered packet
 
 #ifdef DYN_VERBOSE
     if(debugSerial) {
-        debugSerial->printf("Sent (%i):\n",packet->dataSize);
-        for(int i = 0;i<packet->dataSize;i++)
+        debugSerial->printf("Sent (%i):\n",dataSize);
+        for(int i = 0;i<dataSize;i++)
         {
             debugSerial->print((int)(txBuffer[i]));
             debugSerial->print(",");
@@ -76,11 +1341,11 @@ char* DynamixelManager::sendPacket(DynamixelPacketData* packet) const
         debugSerial->println("");
     }
 #endif
-    serial->readBytes(txBuffer,packet->dataSize);   // Reads sent packet to clear serial
+    serial->readBytes(txBuffer,dataSize);           // Reads sent packet to clear serial
 #ifdef DYN_VERBOSE
     if(debugSerial) {
-        debugSerial->printf("Sent (read from Serial) (%i):\n",packet->dataSize);
-        for(int i = 0;i<packet->dataSize;i++)
+        debugSerial->printf("Sent (read from Serial) (%i):\n",dataSize);
+        for(int i = 0;i<dataSize;i++)
         {
             debugSerial->print((int)(txBuffer[i]));
             debugSerial->print(",");
@@ -89,9 +1354,6 @@ char* DynamixelManager::sendPacket(DynamixelPacketData* packet) const
     }
 #endif
 
-    memset(txBuffer,0,packet->dataSize);            // Clears transmission buffer
-    uint8_t responseSize = packet->responseSize;
-    delete packet;
-
+    memset(txBuffer,0,dataSize);                    // Clears transmission buffer
     return readPacket(responseSize);
 }
\ No newline at end of file
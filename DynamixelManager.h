@@ -9,10 +9,37 @@
 #include "DynamixelUtils.h"
 #include "DynamixelPacketSender.h"
 #include "DynamixelMotor.h"
-#include <map>
 
 // TODO : Rajouter les vraies fonctions de manager
 
+#ifndef DYN_BUFFER_SIZE
+#define DYN_BUFFER_SIZE 128         //!< Size of the transmission and reception buffers
+#endif
+
+#ifndef DYN_QUEUE_SIZE
+#define DYN_QUEUE_SIZE 16           //!< Maximum number of pending transactions
+#endif
+
+#ifndef DYN_PROBE_BATCH
+#define DYN_PROBE_BATCH 2           //!< Maximum number of motors pinged per cycle by the hot-plug prober
+#endif
+
+#ifndef DYN_PROBE_MISSES
+#define DYN_PROBE_MISSES 3          //!< Consecutive unanswered probes after which a motor is considered missing
+#endif
+
+#ifndef DYN_MAX_TELEMETRY
+#define DYN_MAX_TELEMETRY 16        //!< Maximum number of periodic background reads
+#endif
+
+#ifndef DYN_MAX_CYCLE_TASKS
+#define DYN_MAX_CYCLE_TASKS 4       //!< Maximum number of control tasks run at each cycle
+#endif
+
+#ifndef DYN_MAX_RESTORES
+#define DYN_MAX_RESTORES 2          //!< Maximum number of motors whose configuration is restored at the same time
+#endif
+
 typedef DynamixelMotor* MotorGeneratorFunctionType(uint8_t, DynamixelPacketSender*);
 //!High-level DynamixelMotor interface
 /*!
@@ -20,7 +47,10 @@ typedef DynamixelMotor* MotorGeneratorFunctionType(uint8_t, DynamixelPacketSende
  * It provides the sendPacket() function which sends a DynamixelPacket and returns the response.
  * <br>The second goal of the DynamixelManager is to provide a high-level interface to use DynamixelMotor objects :
  * \li Motor instantiation and ID conflict prevention
- * \li Motor control by ID
+ * \li Motor control by ID, through a dense ID to index table
+ * \li Joint state of every motor as a structure of arrays, filled by a single SyncRead
+ * \li Prioritized transaction queue : control transactions are always sent first, background telemetry is only sent
+ * when the wire-time model shows it fits in the remaining cycle slack
  */
 class DynamixelManager: public DynamixelPacketSender {
 
@@ -29,7 +59,7 @@ public:
     /**
      * Constructs a new DynamixelManager with the serial used for communication with Dynamixel motors and one for debugging that must have begun communication (with begin() ) (can be left to NULL if not needed)
      */
-    explicit DynamixelManager(HardwareSerial*, usb_serial_class*);
+    explicit DynamixelManager(HardwareSerial*, usb_serial_class* = NULL, uint32_t baudrate = 57600);
 
 
     /*!
@@ -39,30 +69,370 @@ public:
      * @param packet
      * @return Response string, eventually empty.
      */
-    char* sendPacket(DynamixelPacketData *) const override;
+    char* sendPacket(DynamixelPacketData *) const final;
+
+    /*!
+     * Sends the first dataSize bytes of txBuffer and returns the response, like sendPacket() but without any
+     * DynamixelPacketData allocation. Used by the statically dispatched BasicMotor.
+     */
+    char* sendFrame(uint8_t dataSize, uint8_t responseSize) const;
+
+    /*!
+     * Queues a frame without any answer (e.g. a Sync Write) for transmission and returns without waiting for it to
+     * leave the UART. The frame must stay untouched until the next transmission, and its echo is consumed by the
+     * next call to sendFrame() or sendFrameAsync().
+     */
+    void sendFrameAsync(const char* frame, uint8_t size) const;
+
+    //! Waits for the echo of the last frame sent by sendFrameAsync(), if any
+    void drainEcho() const;
+
+    //! Discards every byte already received, e.g. the remains of an answer which missed its deadline
+    void flushInput() const;
 
     /*!
      * Reads a single DynamixelPacket from the serial port.
      * @param responseSize the expected packet size
      * @return The packet string.
      */
-    char* readPacket(uint8_t responseSize) const override;
+    char* readPacket(uint8_t responseSize) const final;
+
+    /*!
+     * Reads a single DynamixelPacket from the serial port, giving up at the deadline instead of waiting for the
+     * serial timeout, so that a missing motor does not stall the following ones.
+     * <br>Bytes before the packet header are skipped, and the size is bounded by DYN_BUFFER_SIZE.
+     * @param deadline micros() value
+     * @param received number of bytes actually received, lower than responseSize if the deadline passed
+     * @return The packet string.
+     */
+    char* readPacketBefore(uint8_t responseSize, uint32_t deadline, uint8_t& received) const;
 
     /*!
      * Creates a motor instance based on the given function, registered with the given ID
-     * @return a new motor instance
+     * @return a new motor instance, nullptr if the ID is already used or DYN_MAX_MOTORS is reached
      */
     DynamixelMotor* createMotor(uint8_t, MotorGeneratorFunctionType);
 
     /*!
      * Get a motor instance based on the given ID
+     * @return nullptr if there is no motor with this ID
+     */
+     DynamixelMotor* getMotor(uint8_t) const;
+
+    //! Registry index of the motor with the given ID, -1 if there is none
+    int getMotorIndex(uint8_t) const;
+
+    /*!
+     * Changes the ID of a registered motor (see DynamixelMotor::changeID()), and moves its registry entry, queued
+     * transactions and telemetry jobs to the new ID. Its registry index, and so its joint states, do not change.
+     * \warning SyncRead and SyncWrite instances built with the old ID must be updated by the caller
+     * @return false if there is no motor with the old ID, the new ID is already used, or the motor did not acknowledge
+     */
+    bool changeMotorID(uint8_t oldId, uint8_t newId);
+
+    uint8_t getMotorCount() const;
+
+    /*!
+     * \name Joint states
+     */
+    //!@{
+
+    //! Per-motor state arrays, indexed by registry index (see getMotorIndex())
+    DynamixelJointStates& getJointStates();
+
+    /*!
+     * Reads present current, velocity and position of every registered motor with a single SyncRead, and scatters
+     * the answers into the joint state arrays and the motors shadows.
+     * <br>All motors must be of the same model, with contiguous current, velocity and position registers.
+     * <br>When the model has a realtime tick, it is read in the same block, and samples are timestamped with the motor
+     * clock (see DynamixelMotor::getClock()) rather than with their reception time.
+     * <br>With adaptive polling, only the motors whose poll period elapsed are part of the SyncRead, see
+     * setPollingPolicy().
+     * @return false if any motor failed to answer properly
      */
-     DynamixelMotor* getMotor(uint8_t);
+    bool readJointStates();
+
+    /*!
+     * Sets the polling policy of readJointStates(). Adaptive polling is disabled by default: every motor is read at
+     * every call.
+     * <br>The distance to goal is computed from the goalPosition joint state array, which control code must keep up
+     * to date for the motors it moves.
+     */
+    void setPollingPolicy(const DynamixelPollingPolicy&);
+
+    //! Current poll period of the motor at the given registry index, in microseconds
+    uint32_t getPollPeriod(uint8_t index) const;
+    //!@}
+
+    /*!
+     * \name Health monitoring
+     * Status packets carry an alert bit when the motor has a hardware error. Decoders record it on the motor, and
+     * processQueue() queues a background read of Hardware Error Status for the motors which raised it only: health
+     * monitoring costs no bus time while every motor is fine.
+     */
+    //!@{
+
+    //! Records the alert bit of a valid answer of the given motor, called by the status packet decoders
+    void noteAlert(uint8_t id, bool alert) const;
+
+    //! Sets the function called with the Hardware Error Status of every motor which raised an alert
+    void setHardwareErrorCallback(HardwareErrorCallbackType*, void*);
+    //!@}
+
+    /*!
+     * \name Hot-plug
+     * Once enabled, processQueue() pings DYN_PROBE_BATCH registered motors, round-robin, in the slack left after every
+     * other transaction: control traffic is never delayed.
+     * <br>A motor which misses DYN_PROBE_MISSES probes in a row is missing, and left out of readJointStates(). When it
+     * answers again, its cached configuration (torque off, operating mode, known gains, goals and profiles, then torque)
+     * is listed once and queued as background writes, as far as the queue allows, and it only joins the group reads again once the last of them
+     * succeeded. A failed restore write marks it missing again.
+     * <br>Queued transactions of a motor which is not present fail without being sent, and its telemetry and hardware
+     * error reads wait for it.
+     * <br>Only registered motors are probed. IDs without a motor are only scanned, one per cycle, once a discovery
+     * callback is set: the application decides whether to create a motor for them.
+     */
+    //!@{
+
+    /*!
+     * Sends a Ping instruction and waits for the answer
+     * @return true if the motor answered properly
+     */
+    bool ping(uint8_t id) const;
+
+    //! Shortest time, in microseconds, between two probes of the same motor. 0 (default) disables probing.
+    void setProbePeriod(uint32_t);
+
+    //! Whether the motor answered the last probes and is fully restored, motors are present until probes fail
+    bool isPresent(uint8_t id) const;
+
+    //! Callback called when an unregistered ID answers a ping, nullptr (default) disables the scan
+    void setDiscoveryCallback(MotorDiscoveryCallbackType*, void*);
+    //!@}
+
+    /*!
+     * \name Transaction queue
+     * Queued transactions are only sent by processQueue(). An access to a range adjacent to, or overlapping, the last
+     * one queued for the same motor is merged with it, so that a burst of writes (or reads) becomes one transaction. Control transactions are always sent, in the order they
+     * were queued. Background transactions and telemetry jobs are only sent while their estimated wire time fits
+     * before the cycle deadline, otherwise they wait for the next cycle.
+     */
+    //!@{
+
+    /*!
+     * Queues a write of the given register(s)
+     * @return false if the queue is full or the data is longer than DYN_TRANSACTION_DATA_SIZE
+     */
+    bool queueWrite(uint8_t, const DynamixelAccessData&, const char*, TransactionPriority = CONTROL_PRIORITY,
+                    TransactionCallbackType* = nullptr, void* = nullptr);
+
+    /*!
+     * Queues a read of the given register(s), the callback receives the data once it is available
+     * @return false if the queue is full or the answer would not fit in the reception buffer
+     */
+    bool queueRead(uint8_t, const DynamixelAccessData&, TransactionPriority, TransactionCallbackType*, void*);
+
+    /*!
+     * Registers a periodic background read (temperature, input voltage, hardware error...)
+     * @param period Minimum time between two reads, in microseconds
+     * @return the job index, or -1 if there is no room left or the answer would not fit in the reception buffer
+     */
+    int addTelemetry(uint8_t, const DynamixelAccessData&, uint32_t period, TransactionCallbackType*, void*);
+
+    /*!
+     * Runs the cycle tasks, sends every queued control transaction, then as many background transactions as possible
+     * before the deadline.
+     * @param cycleDeadline micros() timestamp at which the current cycle ends
+     */
+    void processQueue(uint32_t cycleDeadline);
+
+    //! Estimated bus time of a transaction, in microseconds, including the motor return delay
+    uint32_t estimateTransactionTime(uint16_t sentBytes, uint16_t receivedBytes) const;
+
+    //! Sets the motors return delay time used by the wire-time model (500us by default, as on the XL430)
+    void setReturnDelay(uint32_t);
+
+    /*!
+     * Refreshes the shadow of every given motor with a single SyncRead of the whole shadow area.
+     * All motors must be of the same model, and there are at most DYN_MAX_MOTORS of them.
+     */
+    bool refreshShadows(const uint8_t* ids, uint8_t count);
+    //!@}
+
+    /*!
+     * \name Control cycle accounting
+     * A control cycle starts with beginCycle() and ends with endCycle(), which sends the queued transactions and
+     * checks the deadline. When too many cycles in a row miss it, the DynamixelSheddingPolicy is applied until the
+     * cycles are on time again.
+     */
+    //!@{
+
+    //! Starts a new cycle, its deadline is period microseconds from now
+    void beginCycle(uint32_t period);
+
+    //! Sends queued transactions in the remaining time, then records the cycle end and updates the shedding state
+    void endCycle();
+
+    /*!
+     * Registers a control task, e.g. an EffortLoop, run by processQueue() before any queued transaction: its bus time
+     * is accounted for in the cycle, and background traffic only uses the slack it leaves
+     * @return false if DYN_MAX_CYCLE_TASKS tasks are already registered
+     */
+    bool addCycleTask(CycleTaskType*, void*);
+
+    //! Unregisters a control task, the order of the others is kept
+    void removeCycleTask(CycleTaskType*, void*);
+
+    uint32_t getCycleDeadline() const;
+
+    void setSheddingPolicy(const DynamixelSheddingPolicy&);
+
+    const DynamixelCycleStats& getCycleStats() const;
+
+    void resetCycleStats();
+
+    //! Whether the shedding policy is currently applied
+    bool isShedding() const;
+
+    //! Whether SyncRead should use Fast Sync Read, according to the shedding state
+    bool useFastSyncRead() const;
+    //!@}
 
     HardwareSerial* serial;
 private:
 
-    std::map<uint8_t, DynamixelMotor*> motorMap;
+    //! Sends a single transaction and calls its callback
+    void executeTransaction(DynamixelTransaction&);
+
+    //! Merges the transaction with the last one queued for the same motor, or appends it to the queue
+    bool enqueueTransaction(const DynamixelTransaction&);
+
+    //! Tries to merge the incoming transaction into the queued one
+    bool mergeTransaction(DynamixelTransaction& queued, const DynamixelTransaction& incoming) const;
+
+    //! Whether the motor of the transaction is present, or it is one of the writes restoring its configuration
+    bool isReachable(const DynamixelTransaction&) const;
+
+    //! Fills the bytes of a merged write that no segment requested with the motor shadow values
+    void fillWriteGaps(DynamixelTransaction&, const DynamixelShadow&) const;
+
+    //! SyncRead callback storing the answer of a motor in its shadow
+    static void storeShadow(void* manager, uint8_t motorID, bool status, const char* parameters, uint16_t length);
+
+    //! Calls the callback of every segment of the transaction
+    void notifyTransaction(const DynamixelTransaction&, bool status, const char* parameters) const;
+
+    //! Removes a transaction from the queue, keeping the order of the others
+    void removeTransaction(uint8_t);
+
+    //! Checks whether a transaction of the given duration can still be sent before the deadline
+    bool fitsBefore(uint32_t deadline, uint32_t duration) const;
+
+    //! Pings the next motors due, as long as the pings fit before the deadline
+    void probeMotors(uint32_t cycleDeadline);
+
+    //! Pings the next unregistered ID, if the ping fits before the deadline
+    void scanUnregistered(uint32_t cycleDeadline);
+
+    /*!
+     * Lists the writes restoring the cached configuration of a motor which answered again, in a free restore slot,
+     * and queues as many of them as possible
+     * @return false if every restore slot is in use
+     */
+    bool startRestore(uint8_t index);
+
+    /*!
+     * Queues the background writes of a restore, from the first one not queued yet
+     * @return false if the queue filled up before the last one
+     */
+    bool restoreConfiguration(DynamixelRestore&);
+
+    //! Frees the restore slot of a motor, if it has one
+    void endRestore(uint8_t index);
+
+    //! Write callback of the intermediate restore steps
+    static void restoreStepDone(void* manager, uint8_t motorID, bool status, const char*, uint16_t);
+
+    //! Write callback of the last restore step, the motor is present again once it succeeded
+    static void restoreDone(void* manager, uint8_t motorID, bool status, const char*, uint16_t);
+
+    //! Queues a Hardware Error Status read for every motor with a pending alert, not already queued
+    void queueHardwareErrorReads();
+
+    //! Read callback storing a Hardware Error Status and notifying the application
+    static void storeHardwareError(void* manager, uint8_t motorID, bool status, const char* parameters, uint16_t length);
+
+    //! Register block read by readJointStates(): from the realtime tick (if any) or current to position
+    static void jointStateBlock(const DynamixelModel&, uint16_t& start, uint16_t& length);
+
+    //! SyncRead callback scattering a motor answer into the joint state arrays
+    static void storeJointState(void* manager, uint8_t motorID, bool status, const char* parameters, uint16_t length);
+
+    //! Whether the motor at the given registry index needs to be polled at full rate
+    bool isActive(uint8_t index, uint32_t now) const;
+
+    //! Updates the poll period of the motor at the given registry index after it was polled
+    void updatePollPeriod(uint8_t index, uint32_t now);
+
+    //! Registry index of each ID, noMotor if the ID is unused
+    uint8_t motorIndices[DYN_ID_SLOTS];
+    DynamixelMotor* motors[DYN_MAX_MOTORS];
+    uint8_t motorCount;
+
+    static constexpr uint8_t noMotor = 0xFF;
+
+    DynamixelJointStates jointStates;
+
+    DynamixelPollingPolicy pollingPolicy;
+    uint32_t pollPeriods[DYN_MAX_MOTORS];
+    uint32_t nextPolls[DYN_MAX_MOTORS];     //!< micros() value at which each motor is due
+
+    bool hardwareErrorQueued[DYN_MAX_MOTORS];
+
+    //! Hot-plug state of a registered motor
+    enum MotorPresence
+    {
+        MOTOR_PRESENT,
+        MOTOR_MISSING,
+        MOTOR_RESTORING     //!< Answered again, its configuration is being written back
+    };
+
+    uint8_t presence[DYN_MAX_MOTORS];       //!< MotorPresence of each motor
+    uint8_t probeMisses[DYN_MAX_MOTORS];    //!< Consecutive unanswered probes
+    uint8_t restorePending[DYN_MAX_MOTORS]; //!< Restore writes queued and not answered yet
+    DynamixelRestore restores[DYN_MAX_RESTORES];
+    uint32_t probePeriod;
+    uint32_t lastProbes[DYN_MAX_MOTORS];    //!< micros() value of the last probe of each motor
+    uint8_t nextProbe;                      //!< Round-robin start
+    uint8_t nextScan;                       //!< Next ID scanned for an unregistered motor
+    MotorDiscoveryCallbackType* discoveryCallback;
+    void* discoveryContext;
+    HardwareErrorCallbackType* hardwareErrorCallback;
+    void* hardwareErrorContext;
+
+    uint32_t baudrate;
+    uint32_t returnDelay;
+
+    //! Echo bytes of asynchronous frames still to be read back
+    mutable uint16_t pendingEcho;
+
+    DynamixelTransaction transactionQueue[DYN_QUEUE_SIZE];
+    uint8_t queuedTransactions;
+
+    DynamixelTelemetryJob telemetryJobs[DYN_MAX_TELEMETRY];
+    uint8_t telemetryCount;
+    uint8_t nextTelemetry;      //!< Round-robin start, so that a long job does not starve the others
+
+    CycleTaskType* cycleTasks[DYN_MAX_CYCLE_TASKS];
+    void* cycleTaskContexts[DYN_MAX_CYCLE_TASKS];
+    uint8_t cycleTaskCount;
+
+    DynamixelSheddingPolicy sheddingPolicy;
+    DynamixelCycleStats cycleStats;
+    bool shedding;
+
+    //! Whether the given shedding action is currently applied
+    bool isShedding(SheddingActions) const;
 
     usb_serial_class* debugSerial;
 };
@@ -4,7 +4,9 @@
 
 #include "DynamixelMotor.h"
 
-DynamixelMotor::DynamixelMotor(uint8_t id, DynamixelMotorData data, const DynamixelPacketSender& dynamixelManager) : manager(dynamixelManager),motorID(id), motorData(data)
+DynamixelMotor::DynamixelMotor(uint8_t id, const DynamixelModel& motorModel, const DynamixelPacketSender& dynamixelManager) : manager(dynamixelManager),
+                                model(motorModel), motorID(id), writeBackCount(0), operatingMode(0), operatingModeKnown(false),
+                                shadowStaleness(0), shadow(motorModel.shadowLayout), alertPending(false), hardwareError(0)
 {
 
 }
@@ -15,17 +17,17 @@ int DynamixelMotor::getId() {
 
 float DynamixelMotor::getTorqueFromValue()
 {
-    return(motorData.valueToTorque);
+    return(model.valueToTorque);
 }
 
 float DynamixelMotor::getAngleFromValue()
 {
-    return(motorData.valueToAngle);
+    return(model.valueToAngle);
 }
 
 float DynamixelMotor::getVelocityFromValue()
 {
-    return(motorData.valueToVelocity);
+    return(model.valueToVelocity);
 }
 
 
@@ -39,96 +41,143 @@ float DynamixelMotor::getVelocityFromValue()
 bool DynamixelMotor::changeID(uint8_t id)
 {
     char parameter[1] = {id};
-    motorID = id;
-    char* returnPacket = manager.sendPacket(makeWritePacket(motorData.id, parameter));
-    return(decapsulatePacket(returnPacket));
+    // The packet is addressed to the current ID, the new one is only used afterwards
+    char* returnPacket = manager.sendPacket(makeWritePacket(model.id, parameter));
+    bool status = decapsulatePacket(returnPacket);
+    if(status)
+    {
+        motorID = id;
+    }
+    return(status);
 }
 
 bool DynamixelMotor::changeLED(bool state)
 {
     char parameter[1] = {state};
-    char* returnPacket = manager.sendPacket(makeWritePacket(motorData.led,parameter));
-    return(decapsulatePacket(returnPacket));
+    return(writeValue(model.led,parameter));
 }
 
 bool DynamixelMotor::toggleTorque(bool state)
 {
     char parameter[1] = {state};
-    char* returnPacket = manager.sendPacket(makeWritePacket(motorData.torqueEnable,parameter));
-    return(decapsulatePacket(returnPacket));
+    return(writeValue(model.torqueEnable,parameter));
 }
 
 bool DynamixelMotor::setGoalAngle(float targetAngleDegree)
 {
-    uint32_t targetAngleValue = (uint32_t)(targetAngleDegree/motorData.valueToAngle);
-    char parameter[motorData.goalAngle.length];
-
-    for(int i = 0;i<motorData.goalAngle.length;i++)
-    {
-        parameter[i] = targetAngleValue & 0xFF;
-        targetAngleValue = targetAngleValue >> 8;
-    }
+    char parameter[4];
+    encodeLittleEndian(parameter, unitsToValue(targetAngleDegree, model.valueToAngle, model.goalAngle.length), model.goalAngle.length);
 
-    char* returnPacket = manager.sendPacket(makeWritePacket(motorData.goalAngle,parameter));
-    return(decapsulatePacket(returnPacket));
+    return(writeValue(model.goalAngle,parameter));
 }
 
 bool DynamixelMotor::getCurrentAngle(float &angle)
 {
-    char* returnPacket = manager.sendPacket(makeReadPacket(motorData.currentAngle));
-    bool status = decapsulatePacket(returnPacket,angle);
-    angle *= getAngleFromValue();
+    int32_t value = 0;
+    bool status = readValue(model.currentAngle,value);
+    angle = value * getAngleFromValue();
 
     return(status);
 }
 
 bool DynamixelMotor::setGoalVelocity(float targetVelocity)
 {
-    uint32_t targetVelocityValue = (uint32_t)(targetVelocity/motorData.valueToVelocity);
-    char parameter[motorData.goalVelocity.length];
+    char parameter[4];
+    encodeLittleEndian(parameter, unitsToValue(targetVelocity, model.valueToVelocity, model.goalVelocity.length), model.goalVelocity.length);
 
-    for(int i = 0;i<motorData.goalVelocity.length;i++)
-    {
-        parameter[i] = targetVelocityValue & 0xFF;
-        targetVelocityValue = targetVelocityValue >> 8;
-    }
-    char* returnPacket = manager.sendPacket(makeWritePacket(motorData.goalVelocity,parameter));
-    return(decapsulatePacket(returnPacket));
+    return(writeValue(model.goalVelocity,parameter));
 }
 
 bool DynamixelMotor::getCurrentVelocity(float &velocity)
 {
-    char* returnPacket = manager.sendPacket(makeReadPacket(motorData.currentVelocity));
-    bool status = decapsulatePacket(returnPacket,velocity);
-    velocity *= getVelocityFromValue();
+    int32_t value = 0;
+    bool status = readValue(model.currentVelocity,value);
+    velocity = value * getVelocityFromValue();
+
+    return(status);
+}
+
+bool DynamixelMotor::setGoalAngleFixed(Millidegrees targetAngle)
+{
+    char parameter[4];
+    encodeLittleEndian(parameter, fixedAngleToValue(targetAngle, model.goalAngle.length), model.goalAngle.length);
+
+    return(writeValue(model.goalAngle,parameter));
+}
+
+bool DynamixelMotor::getCurrentAngleFixed(Millidegrees& angle)
+{
+    int32_t value = 0;
+    bool status = readValue(model.currentAngle,value);
+    angle = fixedAngleFromValue(value);
+
+    return(status);
+}
+
+bool DynamixelMotor::setGoalVelocityFixed(MilliRpm targetVelocity)
+{
+    char parameter[4];
+    encodeLittleEndian(parameter, fixedVelocityToValue(targetVelocity, model.goalVelocity.length), model.goalVelocity.length);
+
+    return(writeValue(model.goalVelocity,parameter));
+}
+
+bool DynamixelMotor::getCurrentVelocityFixed(MilliRpm& velocity)
+{
+    int32_t value = 0;
+    bool status = readValue(model.currentVelocity,value);
+    velocity = fixedVelocityFromValue(value);
 
     return(status);
 }
 
+int32_t DynamixelMotor::fixedAngleToValue(Millidegrees angle, uint8_t length) const
+{
+    return(fixedToValue(angle, model.milliDegreesPerValue, length));
+}
+
+Millidegrees DynamixelMotor::fixedAngleFromValue(int32_t value) const
+{
+    return(fixedFromValue(value, model.milliDegreesPerValue));
+}
+
+int32_t DynamixelMotor::fixedVelocityToValue(MilliRpm velocity, uint8_t length) const
+{
+    return(fixedToValue(velocity, model.milliRpmPerValue, length));
+}
+
+MilliRpm DynamixelMotor::fixedVelocityFromValue(int32_t value) const
+{
+    return(fixedFromValue(value, model.milliRpmPerValue));
+}
+
 /**
- * Broken
+ * Raw, signed, Present Load value
  */
 bool DynamixelMotor::getCurrentTorque(int &torque)
 {
-/* FIXME    char* returnPacket = manager.sendPacket(makeReadPacket(motorData.currentTorque));
-    int torqueInt = 0;
-    bool status = decapsulatePacket(returnPacket,torqueInt);
-    torque = torqueInt*0.1;
-*/
-    char* returnPacket = manager.sendPacket(makeReadPacket(motorData.currentTorque));
-    int torqueInt = 0;
-    bool status = decapsulatePacket(returnPacket);
-    // something that ressembles torque
-    torque = returnPacket[9]; // magic numbers, yay!
+    int32_t value = 0;
+    bool status = readValue(model.currentTorque,value);
+    torque = value;
     return(status);
 }
 
 bool DynamixelMotor::getOperatingMode(uint8_t &mode)
 {
-    char* returnPacket = manager.sendPacket(makeReadPacket(motorData.operatingMode));
-    float tmp;
-    bool status = decapsulatePacket(returnPacket, tmp);
-    mode = (uint8_t)tmp;
+    if(operatingModeKnown)
+    {
+        mode = operatingMode;
+        return(true);
+    }
+
+    int32_t value = 0;
+    bool status = readValue(model.operatingMode,value);
+    mode = (uint8_t)value;
+    if(status)
+    {
+        operatingMode = mode;
+        operatingModeKnown = true;
+    }
 
     return(status);
 }
@@ -136,6 +185,339 @@ bool DynamixelMotor::getOperatingMode(uint8_t &mode)
 bool DynamixelMotor::setOperatingMode(uint8_t mode)
 {
     char parameter[1] = {mode};
-    char* returnPacket = manager.sendPacket(makeWritePacket(motorData.operatingMode, parameter));
-    return(decapsulatePacket(returnPacket));
+    operatingModeKnown = writeValue(model.operatingMode, parameter);
+    operatingMode = mode;
+    return(operatingModeKnown);
+}
+
+bool DynamixelMotor::getCachedOperatingMode(uint8_t& mode) const
+{
+    mode = operatingMode;
+    return(operatingModeKnown);
+}
+
+/*
+ *
+ * Shadow control table
+ *
+ */
+
+void DynamixelMotor::setShadowStaleness(uint32_t maxAge)
+{
+    shadowStaleness = maxAge;
+}
+
+bool DynamixelMotor::refreshShadow()
+{
+    const DynamixelShadowLayout* layout = shadow.getLayout();
+    if(!layout)
+    {
+        return(false);
+    }
+
+    DynamixelAccessData area((uint8_t)(layout->startAddress & 0xFF), (uint8_t)(layout->startAddress >> 8), layout->length);
+    char* returnPacket = manager.sendPacket(makeReadPacket(area));
+    bool status = decapsulatePacket(returnPacket);
+    if(status)
+    {
+        updateShadow(layout->startAddress, returnPacket + dynamixelV2::responseParameterStart, layout->length);
+    }
+    return(status);
+}
+
+void DynamixelMotor::invalidateShadow()
+{
+    shadow.invalidate();
+    operatingModeKnown = false;
+    for(uint8_t i = 0; i < writeBackCount; i++)
+    {
+        writeBack[i].acknowledged = false;
+    }
+}
+
+void DynamixelMotor::updateShadow(uint16_t address, const char* data, uint16_t length)
+{
+    updateShadow(address, data, length, micros());
+}
+
+void DynamixelMotor::updateShadow(uint16_t address, const char* data, uint16_t length, uint32_t timestamp)
+{
+    shadow.store(address, data, length, timestamp);
+
+    // Write-back entries keep their own acknowledged value, registers outside of the shadow area included
+    for(uint8_t i = 0; i < writeBackCount; i++)
+    {
+        DynamixelWriteBackEntry& entry = writeBack[i];
+        if(entry.address + entry.length <= address || entry.address >= address + length)
+        {
+            continue;
+        }
+        entry.acknowledged = entry.address >= address && entry.address + entry.length <= address + length;
+        if(entry.acknowledged)
+        {
+            entry.acknowledgedValue = decodeLittleEndian(data + (entry.address - address), entry.length);
+        }
+    }
+
+    uint16_t angleAddress = (uint16_t)(model.currentAngle.address[0] | (model.currentAngle.address[1] << 8));
+    if(address <= angleAddress && angleAddress + model.currentAngle.length <= address + length)
+    {
+        estimator.update(decodeLittleEndian(data + (angleAddress - address), model.currentAngle.length), timestamp);
+    }
+}
+
+const DynamixelShadow& DynamixelMotor::getShadow() const
+{
+    return(shadow);
+}
+
+const DynamixelModel& DynamixelMotor::getModel() const
+{
+    return(model);
+}
+
+const DynamixelEstimator& DynamixelMotor::getEstimator() const
+{
+    return(estimator);
+}
+
+float DynamixelMotor::estimateAngle(uint32_t now) const
+{
+    return(estimator.predictPosition(now) * model.valueToAngle);
+}
+
+DynamixelClock& DynamixelMotor::getClock()
+{
+    return(clock);
+}
+
+void DynamixelMotor::noteAlert(bool alert)
+{
+    if(!alert)
+    {
+        alertPending = false;
+        hardwareError = 0;
+    }
+    else if(hardwareError == 0)
+    {
+        // The alert bit stays set as long as the error does, a known error is not read again
+        alertPending = true;
+    }
+}
+
+bool DynamixelMotor::hasPendingAlert() const
+{
+    return(alertPending);
+}
+
+void DynamixelMotor::setHardwareError(uint8_t error)
+{
+    hardwareError = error;
+    alertPending = false;
+}
+
+uint8_t DynamixelMotor::getHardwareError() const
+{
+    return(hardwareError);
+}
+
+bool DynamixelMotor::readRaw(const DynamixelAccessData& accessData, char* value)
+{
+    uint16_t address = (uint16_t)(accessData.address[0] | (accessData.address[1] << 8));
+    if(shadowStaleness > 0 && shadow.isFresh(address, accessData.length, shadowStaleness))
+    {
+        memcpy(value, shadow.data(address), accessData.length);
+        return(true);
+    }
+
+    char* returnPacket = manager.sendPacket(makeReadPacket(accessData));
+    if(!decapsulatePacket(returnPacket))
+    {
+        memset(value, 0, accessData.length);
+        return(false);
+    }
+
+    updateShadow(address, returnPacket + dynamixelV2::responseParameterStart, accessData.length);
+    memcpy(value, returnPacket + dynamixelV2::responseParameterStart, accessData.length);
+    return(true);
+}
+
+bool DynamixelMotor::readValue(const DynamixelAccessData& accessData, int32_t& value)
+{
+    char raw[4];
+    bool status = readRaw(accessData, raw);
+    value = decodeLittleEndian(raw, accessData.length);
+    return(status);
+}
+
+bool DynamixelMotor::writeValue(const DynamixelAccessData& accessData, char* parameters)
+{
+    char* returnPacket = manager.sendPacket(makeWritePacket(accessData, parameters));
+    bool status = decapsulatePacket(returnPacket);
+    if(status)
+    {
+        updateShadow((uint16_t)(accessData.address[0] | (accessData.address[1] << 8)), parameters, accessData.length);
+    }
+    return(status);
+}
+
+/*
+ *
+ * Write-back
+ *
+ */
+
+bool DynamixelMotor::stageGoalAngle(float targetAngleDegree)
+{
+    return(stageValue(model.goalAngle, unitsToValue(targetAngleDegree, model.valueToAngle, model.goalAngle.length)));
+}
+
+bool DynamixelMotor::stageGoalVelocity(float targetVelocity)
+{
+    return(stageValue(model.goalVelocity, unitsToValue(targetVelocity, model.valueToVelocity, model.goalVelocity.length)));
+}
+
+bool DynamixelMotor::stageGoalAngleFixed(Millidegrees targetAngle)
+{
+    return(stageValue(model.goalAngle, fixedAngleToValue(targetAngle, model.goalAngle.length)));
+}
+
+bool DynamixelMotor::stageValue(const DynamixelAccessData& accessData, int32_t value, bool isSigned)
+{
+    DynamixelWriteBackEntry* entry = getWriteBackEntry(accessData);
+    if(!entry)
+    {
+        return(false);
+    }
+
+    entry->pendingValue = value;
+    entry->isSigned = isSigned;
+    // Anything never acknowledged (or older than the last invalidateShadow()) has to be written
+    if(!entry->acknowledged)
+    {
+        entry->dirty = true;
+        return(true);
+    }
+
+    int64_t difference = extendRegisterValue(value, entry->length, isSigned)
+                         - extendRegisterValue(entry->acknowledgedValue, entry->length, isSigned);
+    entry->dirty = (difference < 0 ? -difference : difference) > entry->deadband;
+    return(true);
+}
+
+bool DynamixelMotor::setDeadband(const DynamixelAccessData& accessData, uint32_t deadband)
+{
+    DynamixelWriteBackEntry* entry = getWriteBackEntry(accessData);
+    if(!entry)
+    {
+        return(false);
+    }
+
+    entry->deadband = (uint16_t)min(deadband, (uint32_t)0xFFFF);
+    return(true);
+}
+
+bool DynamixelMotor::flush()
+{
+    bool status = true;
+    uint8_t first = 0;
+    while(first < writeBackCount)
+    {
+        if(!writeBack[first].dirty)
+        {
+            first++;
+            continue;
+        }
+
+        // Extends the transaction to the next dirty registers, as long as the bytes in between can be re-written
+        uint16_t start = writeBack[first].address;
+        uint16_t end = start + writeBack[first].length;
+        uint8_t last = first;
+        for(uint8_t next = first + 1; next < writeBackCount; next++)
+        {
+            const DynamixelWriteBackEntry& entry = writeBack[next];
+            if(!entry.dirty)
+            {
+                continue;
+            }
+            if(entry.address + entry.length - start > DYN_TRANSACTION_DATA_SIZE
+               || (entry.address > end && !shadow.canFill(end, entry.address - end)))
+            {
+                break;
+            }
+            end = entry.address + entry.length;
+            last = next;
+        }
+
+        char parameters[DYN_TRANSACTION_DATA_SIZE];
+        uint16_t position = start;
+        for(uint8_t index = first; index <= last; index++)
+        {
+            const DynamixelWriteBackEntry& entry = writeBack[index];
+            if(!entry.dirty)
+            {
+                continue;
+            }
+            if(entry.address > position)
+            {
+                memcpy(parameters + (position - start), shadow.data(position), entry.address - position);
+            }
+
+            encodeLittleEndian(parameters + (entry.address - start), entry.pendingValue, entry.length);
+            position = entry.address + entry.length;
+        }
+
+        DynamixelAccessData accessData((uint8_t)(start & 0xFF), (uint8_t)(start >> 8), (uint8_t)(end - start));
+        if(writeValue(accessData, parameters))
+        {
+            for(uint8_t index = first; index <= last; index++)
+            {
+                writeBack[index].dirty = false;
+            }
+        }
+        else
+        {
+            status = false;
+        }
+        first = last + 1;
+    }
+    return(status);
+}
+
+bool DynamixelMotor::isDirty() const
+{
+    for(uint8_t i = 0; i < writeBackCount; i++)
+    {
+        if(writeBack[i].dirty)
+        {
+            return(true);
+        }
+    }
+    return(false);
+}
+
+DynamixelWriteBackEntry* DynamixelMotor::getWriteBackEntry(const DynamixelAccessData& accessData)
+{
+    uint16_t address = (uint16_t)(accessData.address[0] | (accessData.address[1] << 8));
+    uint8_t index = 0;
+    while(index < writeBackCount && writeBack[index].address < address)
+    {
+        index++;
+    }
+    if(index < writeBackCount && writeBack[index].address == address)
+    {
+        return(&writeBack[index]);
+    }
+    if(writeBackCount >= DYN_MAX_WRITE_BACK || accessData.length > DYN_TRANSACTION_DATA_SIZE)
+    {
+        return(nullptr);
+    }
+
+    for(uint8_t i = writeBackCount; i > index; i--)
+    {
+        writeBack[i] = writeBack[i-1];
+    }
+    writeBackCount++;
+    writeBack[index] = {address, accessData.length, false, false, true, 0, 0, 0};
+    return(&writeBack[index]);
 }
\ No newline at end of file
@@ -8,6 +8,14 @@
 #include "Arduino.h"
 #include "DynamixelUtils.h"
 #include "DynamixelPacketSender.h"
+#include "DynamixelShadow.h"
+#include "DynamixelEstimator.h"
+#include "DynamixelClock.h"
+#include "DynamixelRegister.h"
+#include "DynamixelConversion.h"
+#include "DynamixelFixedPoint.h"
+#include <new>
+#include <type_traits>
 
 
 //! Abstract class for Dynamixel Motors
@@ -15,12 +23,14 @@
  * This class defines basic functions that every kind of motor can use without having to override them. In order for this
  * to work the makeWritePacket(), makeReadPacket() and decapsulatePacket() have to be defined, allowing for multiple protocols
  * using the same abstract class.
+ * <br>Getters are served from a DynamixelShadow of the motor control table when the cached value is recent enough
+ * (see setShadowStaleness()), otherwise they read the motor and update the shadow.
  */
 class DynamixelMotor {
 
 public:
 
-    DynamixelMotor(uint8_t,DynamixelMotorData,const DynamixelPacketSender &);
+    DynamixelMotor(uint8_t,const DynamixelModel&,const DynamixelPacketSender &);
 
 
 
@@ -37,6 +47,7 @@ public:
     virtual float getAngleFromValue();
     virtual float getVelocityFromValue();
 
+    //! Registered motors must change their ID through DynamixelManager::changeMotorID(), which updates the registry
     virtual bool changeID(uint8_t);
     virtual bool changeLED(bool);
     virtual bool toggleTorque(bool);
@@ -47,6 +58,141 @@ public:
     virtual bool getCurrentTorque(int&);
     virtual bool getOperatingMode(uint8_t&);
     virtual bool setOperatingMode(uint8_t);
+
+    //! Cached operating mode, without any bus access. false if it is not known
+    bool getCachedOperatingMode(uint8_t&) const;
+    //!@}
+
+    /*!
+     * \name Typed register access
+     * The value type must have the size of the register, which is checked at compile time.
+     * \sa XL430Registers
+     */
+    //!@{
+    template<typename Reg, typename V>
+    bool read(V& value)
+    {
+        static_assert(sizeof(V) == Reg::length, "Value size does not match the register size");
+        char raw[Reg::length];
+        if(!readRaw(Reg::access(), raw))
+        {
+            return(false);
+        }
+        value = (V)Reg::load(raw);
+        return(true);
+    }
+
+    template<typename Reg, typename V>
+    bool write(V value)
+    {
+        static_assert(sizeof(V) == Reg::length, "Value size does not match the register size");
+        char raw[Reg::length];
+        Reg::store(raw, (typename Reg::type)value);
+        return(writeValue(Reg::access(), raw));
+    }
+    //!@}
+
+    /*!
+     * \name Fixed-point API
+     * Same as the float functions, with integer physical units, for boards without FPU
+     */
+    //!@{
+    bool setGoalAngleFixed(Millidegrees);
+    bool getCurrentAngleFixed(Millidegrees&);
+    bool setGoalVelocityFixed(MilliRpm);
+    bool getCurrentVelocityFixed(MilliRpm&);
+    bool stageGoalAngleFixed(Millidegrees);
+    //!@}
+
+    /*!
+     * \name Shadow control table
+     */
+    //!@{
+
+    //! Maximum age, in microseconds, of a shadow value served by the getters. 0 (default) always reads the motor.
+    void setShadowStaleness(uint32_t);
+
+    //! Forces a refresh of the whole shadow area with a single contiguous read
+    bool refreshShadow();
+
+    //! Forgets every cached value, the next getters will read the motor
+    void invalidateShadow();
+
+    //! Stores values received from or acknowledged by the motor
+    void updateShadow(uint16_t address, const char* data, uint16_t length);
+
+    //! Same as updateShadow(), with the micros() value at which the motor sampled the data
+    void updateShadow(uint16_t address, const char* data, uint16_t length, uint32_t timestamp);
+
+    const DynamixelShadow& getShadow() const;
+    //!@}
+
+    const DynamixelModel& getModel() const;
+
+    /*!
+     * \name Estimation
+     * Every position read, individual or group, updates an alpha-beta filter which answers between reads.
+     */
+    //!@{
+    const DynamixelEstimator& getEstimator() const;
+
+    //! Angle extrapolated at the given micros() value, without any bus access
+    float estimateAngle(uint32_t now) const;
+
+    //! Offset of the motor Realtime Tick to micros(), kept up to date by group reads which include the tick
+    DynamixelClock& getClock();
+    //!@}
+
+    /*!
+     * \name Health
+     * Every status packet decoder records the alert bit. A raised alert stays pending until the manager reads the
+     * Hardware Error Status, so that a healthy motor costs no bus time.
+     */
+    //!@{
+
+    //! Records the alert bit of a valid status packet
+    void noteAlert(bool);
+
+    //! Whether an alert was raised and the Hardware Error Status was not read since
+    bool hasPendingAlert() const;
+
+    //! Stores the Hardware Error Status read after an alert
+    void setHardwareError(uint8_t);
+
+    //! Last Hardware Error Status, 0 once the motor answers without alert again
+    uint8_t getHardwareError() const;
+    //!@}
+
+    /*!
+     * \name Write-back
+     * Staged values are only marked dirty when they differ from the last acknowledged one by more than the register
+     * deadband, and only dirty registers are sent by flush(). Holding a pose thus costs no bus traffic.
+     */
+    //!@{
+    virtual bool stageGoalAngle(float);
+    virtual bool stageGoalVelocity(float);
+
+    /*!
+     * Stages a raw register value, false if there is no room left for a new register
+     * @param isSigned signedness of the register, so that the deadband compares values of unsigned registers properly
+     */
+    bool stageValue(const DynamixelAccessData&, int32_t, bool isSigned = true);
+
+    //! Typed stageValue(), e.g. stage<XL430Registers::ProfileVelocity>(velocity)
+    template<typename Reg>
+    bool stage(typename Reg::type value)
+    {
+        return(stageValue(Reg::access(), (int32_t)value, std::is_signed<typename Reg::type>::value));
+    }
+
+    //! Sets the deadband of a register, in raw units (e.g. encoder ticks for the goal angle), at most 65535. 0 by default.
+    bool setDeadband(const DynamixelAccessData&, uint32_t);
+
+    //! Writes every dirty register, adjacent ones in a single transaction
+    bool flush();
+
+    //! Whether some staged values are waiting for flush()
+    bool isDirty() const;
     //!@}
 
 
@@ -80,11 +226,90 @@ public:
 
 protected:
 
+    /*!
+     * \name Fixed-point scales
+     * Scale the model's fixed-point units at runtime. Models with constant scales override them with a FixedPointScale,
+     * which turns the divisions into multiplications.
+     */
+    //!@{
+    virtual int32_t fixedAngleToValue(Millidegrees, uint8_t length) const;
+    virtual Millidegrees fixedAngleFromValue(int32_t) const;
+    virtual int32_t fixedVelocityToValue(MilliRpm, uint8_t length) const;
+    virtual MilliRpm fixedVelocityFromValue(int32_t) const;
+    //!@}
+
+    //! Reads the register bytes from the shadow if they are fresh enough, from the motor otherwise
+    bool readRaw(const DynamixelAccessData&, char*);
+
+    //! Reads a signed value of 1, 2 or 4 bytes, see readRaw()
+    bool readValue(const DynamixelAccessData&, int32_t&);
+
+    //! Writes the parameters to the motor and updates the shadow if the write is acknowledged
+    bool writeValue(const DynamixelAccessData&, char*);
+
+    //! Finds the write-back entry of a register, creating it if needed. nullptr if the table is full.
+    DynamixelWriteBackEntry* getWriteBackEntry(const DynamixelAccessData&);
+
     const DynamixelPacketSender& manager;
 
+    //! Shared by every motor of the same model
+    const DynamixelModel& model;
+
+    /*!
+     * \name Per-motor state
+     * Members are ordered to avoid padding, as deployments may have more than a hundred motors.
+     */
+    //!@{
     uint8_t motorID;
 
-    DynamixelMotorData motorData;
+    uint8_t writeBackCount;
+
+    //! The operating mode is in EEPROM, and can only change with setOperatingMode(), so it is cached once known
+    uint8_t operatingMode;
+    bool operatingModeKnown;
+
+    uint32_t shadowStaleness;
+
+    DynamixelShadow shadow;
+
+    DynamixelEstimator estimator;
+    DynamixelClock clock;
+
+    bool alertPending;
+    uint8_t hardwareError;
+
+    DynamixelWriteBackEntry writeBack[DYN_MAX_WRITE_BACK];     //!< Sorted by address
+    //!@}
+};
+
+//! Statically allocated storage for motors of a single model
+/*!
+ * Motors are constructed in place in a static buffer sized at compile time, so that no heap is needed.
+ * \sa XL430GeneratorFunction
+ */
+template<typename Motor, unsigned int Capacity>
+class DynamixelMotorArena {
+
+public:
+
+    constexpr DynamixelMotorArena() : storage(), count(0)
+    {}
+
+    //! @return a new motor, nullptr if the arena is full
+    Motor* create(uint8_t id, const DynamixelPacketSender& manager)
+    {
+        if(count >= Capacity)
+        {
+            return(nullptr);
+        }
+        return(new(&storage[count++]) Motor(id, manager));
+    }
+
+private:
+
+    typename std::aligned_storage<sizeof(Motor), alignof(Motor)>::type storage[Capacity];
+
+    unsigned int count;
 };
 
 
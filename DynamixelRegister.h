@@ -0,0 +1,184 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#ifndef DYNAMIXEL_REGISTER_H
+#define DYNAMIXEL_REGISTER_H
+
+#include "Arduino.h"
+#include "DynamixelUtils.h"
+#include <initializer_list>
+
+//! Little endian codec for fixed-width register values
+/*!
+ * Dynamixel registers are little endian, like the Teensy and Linux hosts, so load and store are plain fixed-size
+ * copies that the compiler reduces to single moves. Signed types are sign-extended by the conversion, without any
+ * branch or byte loop.
+ */
+template<typename T>
+struct DynamixelCodec {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4, "Dynamixel registers are 1, 2 or 4 bytes long");
+
+    static inline T load(const char* data)
+    {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        T value;
+        memcpy(&value, data, sizeof(T));
+        return(value);
+#else
+        uint32_t value = 0;
+        for(unsigned int i = 0; i < sizeof(T); i++)
+        {
+            value |= (uint32_t)(uint8_t)data[i] << (8*i);
+        }
+        return((T)value);
+#endif
+    }
+
+    static inline void store(char* data, T value)
+    {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(data, &value, sizeof(T));
+#else
+        for(unsigned int i = 0; i < sizeof(T); i++)
+        {
+            data[i] = (char)((uint32_t)value >> (8*i));
+        }
+#endif
+    }
+};
+
+//! Compile-time description of a control table register
+/*!
+ * The register type gives both the length on the wire and the signedness of the value.
+ * \sa XL430Registers for the XL430 control table.
+ */
+template<uint16_t Address, typename T>
+struct Register {
+    typedef T type;
+    static constexpr uint16_t address = Address;
+    static constexpr uint8_t length = sizeof(T);
+
+    static inline T load(const char* data)
+    {
+        return(DynamixelCodec<T>::load(data));
+    }
+
+    static inline void store(char* data, T value)
+    {
+        DynamixelCodec<T>::store(data, value);
+    }
+
+    //! Runtime descriptor, for the functions taking a DynamixelAccessData
+    static DynamixelAccessData access()
+    {
+        return(DynamixelAccessData(Address & 0xFF, (Address >> 8) & 0xFF, length));
+    }
+};
+
+//! Register decoded into a member of a record, for RegisterBlock
+template<typename Reg, typename Record, typename Reg::type Record::*Member>
+struct RegisterField {
+    typedef Reg reg;
+
+    static inline void load(const char* blockData, uint16_t blockAddress, Record& record)
+    {
+        record.*Member = Reg::load(blockData + (Reg::address - blockAddress));
+    }
+
+    static inline void store(char* blockData, uint16_t blockAddress, const Record& record)
+    {
+        Reg::store(blockData + (Reg::address - blockAddress), record.*Member);
+    }
+};
+
+//! End address of the last field of a block, checking that fields are in increasing address order
+template<typename... Fields>
+struct RegisterBlockEnd;
+
+template<typename Last>
+struct RegisterBlockEnd<Last> {
+    static constexpr uint16_t value = Last::reg::address + Last::reg::length;
+};
+
+template<typename First, typename Next, typename... Others>
+struct RegisterBlockEnd<First, Next, Others...> {
+    static_assert(First::reg::address + First::reg::length <= Next::reg::address, "Block fields must be in increasing address order, without overlap");
+    static constexpr uint16_t value = RegisterBlockEnd<Next, Others...>::value;
+};
+
+//! Contiguous block of registers, read or written at once and decoded into a Record
+/*!
+ * Fields are RegisterField types in increasing address order. The block spans from the first field to the end of the
+ * last one, the bytes between fields being ignored.
+ * \sa XL430JointStateBlock
+ */
+template<typename Record, typename First, typename... Others>
+struct RegisterBlock {
+    typedef Record record_type;
+    static constexpr uint16_t address = First::reg::address;
+    static constexpr uint16_t length = RegisterBlockEnd<First, Others...>::value - address;
+
+    static inline void load(const char* data, Record& record)
+    {
+        (void)std::initializer_list<int>{(First::load(data, address, record), 0), (Others::load(data, address, record), 0)...};
+    }
+
+    static inline void store(char* data, const Record& record)
+    {
+        (void)std::initializer_list<int>{(First::store(data, address, record), 0), (Others::store(data, address, record), 0)...};
+    }
+
+    //! Runtime descriptor, for the functions taking a DynamixelAccessData
+    static DynamixelAccessData access()
+    {
+        return(DynamixelAccessData(address & 0xFF, (address >> 8) & 0xFF, (uint8_t)length));
+    }
+};
+
+//! Decodes a little endian, two's complement value of 1, 2 or 4 bytes whose length is only known at runtime
+static inline int32_t decodeLittleEndian(const char* data, uint8_t length)
+{
+    switch(length)
+    {
+        case 1:
+            return(DynamixelCodec<int8_t>::load(data));
+        case 2:
+            return(DynamixelCodec<int16_t>::load(data));
+        default:
+            return(DynamixelCodec<int32_t>::load(data));
+    }
+}
+
+//! Value of the low length bytes of a raw value, sign or zero extended according to the register signedness
+static inline int64_t extendRegisterValue(int32_t value, uint8_t length, bool isSigned)
+{
+    switch(length)
+    {
+        case 1:
+            return(isSigned ? (int64_t)(int8_t)value : (int64_t)(uint8_t)value);
+        case 2:
+            return(isSigned ? (int64_t)(int16_t)value : (int64_t)(uint16_t)value);
+        default:
+            return(isSigned ? (int64_t)value : (int64_t)(uint32_t)value);
+    }
+}
+
+//! Encodes the low length bytes of a value, little endian, length being 1, 2 or 4
+static inline void encodeLittleEndian(char* data, int32_t value, uint8_t length)
+{
+    switch(length)
+    {
+        case 1:
+            DynamixelCodec<int8_t>::store(data, (int8_t)value);
+            break;
+        case 2:
+            DynamixelCodec<int16_t>::store(data, (int16_t)value);
+            break;
+        default:
+            DynamixelCodec<int32_t>::store(data, value);
+            break;
+    }
+}
+
+#endif //DYNAMIXEL_REGISTER_H
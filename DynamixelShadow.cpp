@@ -0,0 +1,152 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#include "DynamixelShadow.h"
+
+DynamixelShadow::DynamixelShadow(const DynamixelShadowLayout* layout) : layout(layout), knownFields(0), lastRefresh(0)
+{
+    memset(refreshTimestamps, 0, sizeof(refreshTimestamps));
+    memset(refreshFields, 0, sizeof(refreshFields));
+}
+
+bool DynamixelShadow::covers(uint16_t address, uint16_t length) const
+{
+    return(layout && address >= layout->startAddress && address + length <= layout->startAddress + layout->length);
+}
+
+void DynamixelShadow::store(uint16_t address, const char* data, uint16_t length, uint32_t timestamp)
+{
+    if(!layout)
+    {
+        return;
+    }
+
+    uint32_t updated = 0;
+    for(uint16_t i = 0; i < length; i++)
+    {
+        uint16_t byteAddress = address + i;
+        if(byteAddress < layout->startAddress || byteAddress >= layout->startAddress + layout->length)
+        {
+            continue;
+        }
+
+        uint8_t offset = byteAddress - layout->startAddress;
+        values[offset] = data[i];
+        uint8_t field = layout->byteFields[offset];
+        if(field != DynamixelShadowLayout::noField)
+        {
+            updated |= (uint32_t)1 << field;
+        }
+    }
+    if(updated == 0)
+    {
+        return;
+    }
+    knownFields |= updated;
+
+    // Updates with the same timestamp, e.g. the parts of a single answer, share their refresh
+    if(refreshFields[lastRefresh] == 0 || refreshTimestamps[lastRefresh] != timestamp)
+    {
+        lastRefresh = (lastRefresh + 1) % DYN_SHADOW_REFRESHES;
+        refreshTimestamps[lastRefresh] = timestamp;
+        refreshFields[lastRefresh] = 0;
+    }
+    for(uint8_t i = 0; i < DYN_SHADOW_REFRESHES; i++)
+    {
+        refreshFields[i] &= ~updated;
+    }
+    refreshFields[lastRefresh] |= updated;
+}
+
+uint8_t DynamixelShadow::refreshOf(uint8_t field) const
+{
+    uint32_t mask = (uint32_t)1 << field;
+    for(uint8_t i = 0; i < DYN_SHADOW_REFRESHES; i++)
+    {
+        if(refreshFields[i] & mask)
+        {
+            return(i);
+        }
+    }
+    return(DYN_SHADOW_REFRESHES);
+}
+
+bool DynamixelShadow::isFresh(uint16_t address, uint16_t length, uint32_t maxAge) const
+{
+    uint32_t now = micros();
+    return(covers(address, length) && forEachField(address, length, [this, now, maxAge](uint8_t field) {
+        uint8_t refresh = refreshOf(field);
+        return(refresh < DYN_SHADOW_REFRESHES && now - refreshTimestamps[refresh] <= maxAge);
+    }));
+}
+
+bool DynamixelShadow::isKnown(uint16_t address, uint16_t length) const
+{
+    return(covers(address, length) && forEachField(address, length, [this](uint8_t field) {
+        return((knownFields & ((uint32_t)1 << field)) != 0);
+    }));
+}
+
+bool DynamixelShadow::canFill(uint16_t address, uint16_t length) const
+{
+    if(!covers(address, length))
+    {
+        return(false);
+    }
+
+    for(uint16_t i = 0; i < length; i++)
+    {
+        // Reserved bytes must never be written
+        if(layout->byteFields[address + i - layout->startAddress] == DynamixelShadowLayout::noField)
+        {
+            return(false);
+        }
+    }
+    return(forEachField(address, length, [this](uint8_t field) {
+        uint32_t mask = (uint32_t)1 << field;
+        return((knownFields & mask) && (layout->fillableFields & mask));
+    }));
+}
+
+const char* DynamixelShadow::data(uint16_t address) const
+{
+    return(values + (address - layout->startAddress));
+}
+
+bool DynamixelShadow::getTimestamp(uint16_t address, uint32_t& timestamp) const
+{
+    uint8_t field = layout->byteFields[address - layout->startAddress];
+    uint8_t refresh = field == DynamixelShadowLayout::noField ? DYN_SHADOW_REFRESHES : refreshOf(field);
+    if(refresh >= DYN_SHADOW_REFRESHES)
+    {
+        return(false);
+    }
+    timestamp = refreshTimestamps[refresh];
+    return(true);
+}
+
+void DynamixelShadow::invalidate()
+{
+    knownFields = 0;
+    memset(refreshFields, 0, sizeof(refreshFields));
+}
+
+const DynamixelShadowLayout* DynamixelShadow::getLayout() const
+{
+    return(layout);
+}
+
+template<typename Predicate>
+bool DynamixelShadow::forEachField(uint16_t address, uint16_t length, Predicate predicate) const
+{
+    for(uint16_t i = 0; i < length; i++)
+    {
+        uint8_t field = layout->byteFields[address + i - layout->startAddress];
+        if(field != DynamixelShadowLayout::noField && !predicate(field))
+        {
+            return(false);
+        }
+    }
+    return(true);
+}
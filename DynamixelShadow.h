@@ -0,0 +1,83 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#ifndef DYNAMIXEL_SHADOW_H
+#define DYNAMIXEL_SHADOW_H
+
+#include "Arduino.h"
+#include "DynamixelUtils.h"
+
+#ifndef DYN_SHADOW_SIZE
+#define DYN_SHADOW_SIZE 83          //!< Size of the mirrored area, 83 bytes cover the whole XL430 RAM area (64-146)
+#endif
+
+#define DYN_SHADOW_MAX_FIELDS 32    //!< One bit per field in the known/fillable masks
+
+#ifndef DYN_SHADOW_REFRESHES
+#define DYN_SHADOW_REFRESHES 4      //!< Refreshes whose timestamp is kept, fields last updated before are stale
+#endif
+
+//! Local copy of part of a motor control table
+/*!
+ * Every read or acknowledged write of the mirrored area is stored here, so that getters can be served without any bus
+ * access as long as the value is recent enough.
+ * <br>Timestamps are kept per refresh rather than per field: each of the last DYN_SHADOW_REFRESHES refreshes has a
+ * timestamp and the mask of the fields it last updated. A field updated before them is still known, but stale.
+ * <br>A field is unknown until it has been read or written once.
+ */
+class DynamixelShadow {
+
+public:
+
+    explicit DynamixelShadow(const DynamixelShadowLayout*);
+
+    //! Whether the whole range is part of the mirrored area
+    bool covers(uint16_t address, uint16_t length) const;
+
+    //! Stores data received from (or acknowledged by) the motor, the part outside of the mirrored area is ignored
+    void store(uint16_t address, const char* data, uint16_t length, uint32_t timestamp);
+
+    //! Whether every field of the range is known and was updated less than maxAge microseconds ago
+    bool isFresh(uint16_t address, uint16_t length, uint32_t maxAge) const;
+
+    //! Whether every field of the range is known, whatever its age
+    bool isKnown(uint16_t address, uint16_t length) const;
+
+    //! Whether the range can be filled with shadow values in a merged write
+    bool canFill(uint16_t address, uint16_t length) const;
+
+    //! Pointer to the cached value at the given address, only meaningful if covers() is true
+    const char* data(uint16_t address) const;
+
+    /*!
+     * micros() timestamp of the last update of the field at the given address
+     * @return false if the field was not updated by one of the last DYN_SHADOW_REFRESHES refreshes
+     */
+    bool getTimestamp(uint16_t address, uint32_t& timestamp) const;
+
+    //! Marks every field as unknown
+    void invalidate();
+
+    const DynamixelShadowLayout* getLayout() const;
+
+private:
+
+    //! Calls the function with each field index of the range, stops and returns false as soon as it returns false
+    template<typename Predicate>
+    bool forEachField(uint16_t address, uint16_t length, Predicate predicate) const;
+
+    //! Refresh which last updated the field, DYN_SHADOW_REFRESHES if it is older than all of them
+    uint8_t refreshOf(uint8_t field) const;
+
+    const DynamixelShadowLayout* layout;
+
+    char values[DYN_SHADOW_SIZE];
+    uint32_t knownFields;
+    uint32_t refreshTimestamps[DYN_SHADOW_REFRESHES];
+    uint32_t refreshFields[DYN_SHADOW_REFRESHES];      //!< Fields whose last update is each refresh
+    uint8_t lastRefresh;
+};
+
+
+#endif //DYNAMIXEL_SHADOW_H
@@ -23,10 +23,12 @@ enum dynamixelV2{
     minPacketLength = 12,       //!< With checksum
     minInstructionLength = 5,   //!< Without checksum
     minResponseLength = 5,      //!< Without checksum
+    pingInstruction = 0x01,
     writeInstruction = 0x03,
     readInstruction = 0x02,
     syncWriteInstruction = 0x83,
     syncReadInstruction = 0x82,
+    fastSyncReadInstruction = 0x8A,
     statusInstruction = 0x55,
     alertBit = 128,
     idPos = 4,
@@ -55,7 +57,7 @@ constexpr unsigned char v2Header[4] = {0xFF,0xFF,0xFD,0x00};
  *
  */
 struct DynamixelAccessData {
-    DynamixelAccessData(const uint8_t addressLSB,const uint8_t addressMSB,const uint8_t size) : address{addressLSB,addressMSB}, length(size)
+    constexpr DynamixelAccessData(const uint8_t addressLSB,const uint8_t addressMSB,const uint8_t size) : address{addressLSB,addressMSB}, length(size)
     {}
 
     const uint8_t address[2];    //!< Two bytes, little endian memory address
@@ -64,58 +66,78 @@ struct DynamixelAccessData {
 
 
 
-//! Contains necessary data for data access and conversion
+//! Describes the control table area mirrored by a DynamixelShadow
 /*!
- * <br>It is a protected member of DynamixelMotor thus it can be re-used in child classes,
- * each child defining its own DynamixelAccessData and conversion factors.
- * <br>DynamixelMotor does not define any default value.
+ * The area is split in fields (registers), each field having its own timestamp in the shadow.
+ * <br>Every motor of the same model should reference the same layout.
+ */
+struct DynamixelShadowLayout {
+    uint16_t startAddress;
+    uint8_t length;                 //!< At most DYN_SHADOW_SIZE
+    const uint8_t* byteFields;      //!< Field index of each byte of the area, noField for reserved bytes
+    uint32_t fillableFields;        //!< Fields whose shadow value can safely be re-written to fill the gap of a merged write
+
+    static constexpr uint8_t noField = 0xFF;
+};
+
+
+
+//! Contains necessary data for data access and conversion, shared by every motor of a model
+/*!
+ * <br>Each motor model defines a single constexpr DynamixelModel, which stays in flash, and every motor of that model
+ * references it. DynamixelMotor does not define any default value.
  * <br>The structure contains the following data:
  * \li Angle and velocity readings and targets access
  * \li Torque activation and reading access
  * \li ID and LED access
+ * \li Realtime tick and hardware error access
  * \li Angle, velocity and torque conversion factors
- * \li Motor ID
+ * \li Layout of the control table area mirrored by the motors shadow
  *
  */
-struct DynamixelMotorData {
-
-    DynamixelMotorData(uint8_t newID,const DynamixelAccessData& idAccess,const DynamixelAccessData& ledAccess,
-                       const DynamixelAccessData& torqueEnAccess, const DynamixelAccessData& currentTorqueAccess,
-                       const DynamixelAccessData& goalAngleAccess,const DynamixelAccessData& currentAngleAccess,
-                       const DynamixelAccessData& goalVelocityAccess,const DynamixelAccessData& currentVelocityAccess,
-                       const DynamixelAccessData& operatingMode,
-                       const float torqueConvertFactor,const float angleConvertFactor,const float velocityConvertFactor)
-                        : motorID(newID), id(idAccess), led(ledAccess),
-                          torqueEnable(torqueEnAccess), currentTorque(currentTorqueAccess),
-                          goalAngle(goalAngleAccess), currentAngle(currentAngleAccess),
-                          goalVelocity(goalVelocityAccess), currentVelocity(currentVelocityAccess),
-                          operatingMode(operatingMode),
-                          valueToTorque(torqueConvertFactor), valueToAngle(angleConvertFactor),
-                          valueToVelocity(velocityConvertFactor)
-    {}
+struct DynamixelModel {
+    DynamixelAccessData id;
+    DynamixelAccessData led;
+    DynamixelAccessData torqueEnable;
+    DynamixelAccessData currentTorque;
+    DynamixelAccessData goalAngle;
+    DynamixelAccessData currentAngle;
+    DynamixelAccessData goalVelocity;
+    DynamixelAccessData currentVelocity;
+    DynamixelAccessData operatingMode;
+    DynamixelAccessData realtimeTick;   //!< Millisecond counter timestamping reads, length 0 if the model has none
+    DynamixelAccessData hardwareError;  //!< Read when a status packet has its alert bit set
+
+    float valueToTorque;
+    float valueToAngle;
+    float valueToVelocity;
+
+    int32_t milliDegreesPerValue;       //!< Fixed-point counterpart of valueToAngle
+    int32_t milliRpmPerValue;           //!< Fixed-point counterpart of valueToVelocity
+
+    const DynamixelShadowLayout* shadowLayout;  //!< Control table area cached by the motors, nullptr if none
+};
 
-    uint8_t motorID; //!< Only object-specific attribute, used for ID changes
 
-    /*!
-     * \name Common attributes
-     * Class-specific attributes : each kind of motor has its own. Ideally, every object of the same class should reference
-     * the same DynamixelAccessData objects to minimize memory impact.
-     */
-    //!@{
-    const DynamixelAccessData& id;
-    const DynamixelAccessData& led;
-    const DynamixelAccessData& torqueEnable;
-    const DynamixelAccessData& currentTorque;
-    const DynamixelAccessData& goalAngle;
-    const DynamixelAccessData& currentAngle;
-    const DynamixelAccessData& goalVelocity;
-    const DynamixelAccessData& currentVelocity;
-    const DynamixelAccessData& operatingMode;
 
-    const float valueToTorque;
-    const float valueToAngle;
-    const float valueToVelocity;
-    //!@}
+#ifndef DYN_MAX_WRITE_BACK
+#define DYN_MAX_WRITE_BACK 6        //!< Maximum number of registers staged for write-back per motor
+#endif
+
+//! Register value staged by a DynamixelMotor, written at the next flush if it is dirty
+/*!
+ * The entry keeps the last value the motor acknowledged, whether or not the register is part of the shadow. A staged
+ * value only makes the entry dirty if it differs from it by more than the deadband (in raw register units).
+ */
+struct DynamixelWriteBackEntry {
+    uint16_t address;
+    uint8_t length;
+    bool dirty;
+    bool acknowledged;              //!< Whether acknowledgedValue is known
+    bool isSigned;                  //!< Signedness of the register, for the deadband comparison
+    uint16_t deadband;
+    int32_t pendingValue;
+    int32_t acknowledgedValue;      //!< Raw bits, only the low length bytes are meaningful
 };
 
 
@@ -139,6 +161,196 @@ struct DynamixelPacketData {
 
 
 
+/*
+ * Motor registry
+ */
+
+#ifndef DYN_MAX_MOTORS
+#define DYN_MAX_MOTORS 16       //!< Capacity of the DynamixelManager registry and of the static motor arenas
+#endif
+
+#define DYN_ID_SLOTS 253        //!< Valid Dynamixel IDs are 0 to 252
+
+//! Bits of DynamixelJointStates::errorFlags
+enum JointErrorFlags {
+    JOINT_COMMUNICATION_ERROR = 1,  //!< The last read of the joint failed (timeout or corrupted answer)
+    JOINT_HARDWARE_ERROR = 2        //!< The motor raised its alert bit, see DynamixelMotor::getHardwareError()
+};
+
+//! Per-motor joint state, stored as a structure of arrays indexed by registry index
+/*!
+ * Control code can iterate every array linearly, which keeps the data contiguous in cache and lets the compiler
+ * vectorise the loops. Values are raw register units.
+ */
+struct DynamixelJointStates {
+    uint8_t ids[DYN_MAX_MOTORS];
+    int32_t goalPosition[DYN_MAX_MOTORS];   //!< Filled by control code, not by the bus reads
+    int32_t presentPosition[DYN_MAX_MOTORS];
+    int32_t presentVelocity[DYN_MAX_MOTORS];
+    int16_t presentCurrent[DYN_MAX_MOTORS];
+    uint8_t errorFlags[DYN_MAX_MOTORS];     //!< JointErrorFlags
+    uint32_t timestamp[DYN_MAX_MOTORS];     //!< micros() of the last successful read, at sampling time if available
+};
+
+
+
+//! Per-motor status of a group read, as a bitmask
+enum ReadStatus {
+    READ_OK = 1,            //!< A valid answer was received and decoded
+    READ_CRC_ERROR = 2,     //!< The answer was corrupted
+    READ_TIMEOUT = 4,       //!< No complete answer before the motor deadline
+    READ_ALERT = 8,         //!< Alert bit set: the data is valid but the motor has a hardware error
+    READ_STATUS_ERROR = 16  //!< The motor rejected the instruction (error number in its status)
+};
+
+#ifndef DYN_READ_MARGIN
+#define DYN_READ_MARGIN 500     //!< Slack, in microseconds, added to the expected arrival of each group read answer
+#endif
+
+#ifndef DYN_POLL_IDLE_STEP
+#define DYN_POLL_IDLE_STEP 1000 //!< Shortest poll period, in microseconds, of a motor which just became idle
+#endif
+
+
+
+/*
+ * Transaction scheduling
+ */
+
+#ifndef DYN_TRANSACTION_DATA_SIZE
+#define DYN_TRANSACTION_DATA_SIZE 16    //!< Maximum parameter length of a queued write
+#endif
+
+//! Priority of a queued transaction, lower values are sent first
+enum TransactionPriority {
+    CONTROL_PRIORITY = 0,       //!< Control-loop traffic, always sent during the cycle
+    BACKGROUND_PRIORITY = 1     //!< Telemetry and health polling, only sent if it fits in the cycle slack
+};
+
+/*!
+ * Called once a queued transaction has been answered (or has failed).
+ * <br>For reads, parameters points to the received data (length bytes), for writes it is nullptr.
+ */
+typedef void TransactionCallbackType(void* context, uint8_t motorID, bool status, const char* parameters, uint16_t length);
+
+//! Called when the Hardware Error Status read after an alert is known, see DynamixelManager::setHardwareErrorCallback()
+typedef void HardwareErrorCallbackType(void* context, uint8_t motorID, uint8_t hardwareError);
+
+//! Called when an ID without a registered motor answers a ping, see DynamixelManager::setDiscoveryCallback()
+typedef void MotorDiscoveryCallbackType(void* context, uint8_t motorID);
+
+//! Control task run at the start of every cycle, before the queued transactions, see DynamixelManager::addCycleTask()
+typedef void CycleTaskType(void* context);
+
+#ifndef DYN_MAX_MERGED
+#define DYN_MAX_MERGED 4                //!< Maximum number of queued accesses merged into a single transaction
+#endif
+
+#ifndef DYN_MERGE_GAP
+#define DYN_MERGE_GAP 8                 //!< Maximum number of unrequested bytes a merged read may span
+#endif
+
+//! Part of a transaction requested by a single queueWrite() or queueRead() call
+struct DynamixelTransactionSegment {
+    uint16_t address;
+    uint16_t length;
+    TransactionCallbackType* callback;
+    void* context;
+};
+
+//! Single-motor register access waiting in the DynamixelManager queue
+/*!
+ * Accesses to adjacent or overlapping address ranges of the same motor are merged into a single contiguous
+ * transaction, each original access being kept as a segment so that its callback only sees its own data.
+ */
+struct DynamixelTransaction {
+    uint8_t motorID;
+    uint8_t priority;                           //!< TransactionPriority
+    bool isWrite;
+    uint16_t address;
+    uint16_t length;
+    char data[DYN_TRANSACTION_DATA_SIZE];       //!< Parameters to write, unused for reads
+    DynamixelTransactionSegment segments[DYN_MAX_MERGED];
+    uint8_t segmentCount;
+};
+
+//! Actions the DynamixelManager may take when cycles keep missing their deadline
+enum SheddingActions {
+    SHED_OPTIONAL_READS = 1,    //!< Drops queued background reads instead of sending them
+    SHED_TELEMETRY_RATE = 2,    //!< Divides telemetry rates by DynamixelSheddingPolicy::telemetryDivider
+    SHED_FAST_SYNC_READ = 4     //!< SyncRead uses Fast Sync Read (single status packet for every motor)
+};
+
+//! Configures when and how the DynamixelManager sheds load
+struct DynamixelSheddingPolicy {
+    uint8_t actions;                //!< Combination of SheddingActions, 0 disables shedding
+    uint8_t missThreshold;          //!< Consecutive deadline misses before shedding starts
+    uint8_t recoveryThreshold;      //!< Consecutive on-time cycles before shedding stops
+    uint8_t telemetryDivider;       //!< Telemetry period multiplier while shedding
+};
+
+//! Configures how often DynamixelManager::readJointStates() polls each motor, according to its activity
+/*!
+ * A motor is active when its velocity, its distance to goal or the uncertainty of its estimator is above the
+ * thresholds, or when its last read failed. Active motors are polled every minPeriod; the period of an idle motor
+ * doubles at each read, up to maxPeriod.
+ */
+struct DynamixelPollingPolicy {
+    uint32_t minPeriod;             //!< Period of active motors, in microseconds, 0 to poll them at every call
+    uint32_t maxPeriod;             //!< Period of parked motors, in microseconds, 0 disables adaptive polling
+    int32_t velocityThreshold;      //!< Raw velocity above which a motor is active
+    int32_t positionThreshold;      //!< Raw distance to goal or position uncertainty above which a motor is active
+};
+
+//! Control cycle counters, meant to size chains and baudrates from real data
+struct DynamixelCycleStats {
+    uint32_t cycleCount;
+    uint32_t deadlineMisses;
+    uint32_t consecutiveMisses;
+    uint32_t consecutiveOnTime;
+    uint32_t lastStart;             //!< micros() timestamps of the last cycle
+    uint32_t lastEnd;
+    uint32_t lastDeadline;
+    uint32_t lastDuration;          //!< In microseconds
+    uint32_t worstDuration;
+    uint32_t worstOverrun;          //!< Largest time past the deadline, in microseconds
+    uint32_t shedCycles;            //!< Cycles run while shedding
+    uint32_t droppedTransactions;   //!< Background reads dropped by SHED_OPTIONAL_READS
+};
+
+#ifndef DYN_RESTORE_STEPS
+#define DYN_RESTORE_STEPS 24            //!< Maximum number of writes restoring the configuration of a motor
+#endif
+
+//! One write restoring the configuration of a motor which answered again
+struct DynamixelRestoreStep {
+    uint16_t address;
+    uint8_t length;
+    bool fromShadow;            //!< Data copied from the motor shadow when queued, otherwise the single byte value
+    uint8_t value;
+};
+
+//! Configuration restore of a motor, its steps are listed once, when it starts
+struct DynamixelRestore {
+    uint8_t motorIndex;         //!< Registry index of the motor, DynamixelManager::noMotor if the slot is free
+    uint8_t stepCount;
+    uint8_t queuedSteps;
+    DynamixelRestoreStep steps[DYN_RESTORE_STEPS];
+};
+
+//! Periodic background read, issued by the DynamixelManager when there is enough slack in the cycle
+struct DynamixelTelemetryJob {
+    uint8_t motorID;
+    uint16_t address;
+    uint16_t length;
+    uint32_t period;            //!< In microseconds
+    uint32_t nextDue;           //!< micros() timestamp
+    TransactionCallbackType* callback;
+    void* context;
+};
+
+
+
 /*
  * Error detection functions
  */
@@ -223,4 +435,45 @@ static unsigned short crc_compute(const char *packet_to_check, unsigned short pa
     return crc_accum;
 }
 
-#endif //DYNAMIXEL_UTILS_H
+//! Dynamixel Protocol v2 status packet check
+/*!
+ * Checks the crc, the instruction and the alert bit of a status packet.
+ * @return false if there is any error, true otherwise.
+ */
+static inline bool checkV2Status(const char *packet)
+{
+    unsigned short responseLength = dynamixelV2::minResponseLength + (uint8_t)packet[dynamixelV2::lengthLSBPos] + ((uint8_t)packet[dynamixelV2::lengthMSBPos] << 8);
+
+    // Checks CRC
+    if(crc_compute(packet,responseLength) == ((uint8_t)packet[responseLength]+((uint8_t)packet[responseLength+1] << 8)))
+    {
+        // If valid, checks alert byte and instruction type
+        if(!((uint8_t)packet[dynamixelV2::responseErrorPos] & dynamixelV2::alertBit) && (uint8_t)packet[dynamixelV2::instructionPos] == dynamixelV2::statusInstruction)
+        {
+            return(true);
+        }
+    }
+    return(false);
+}
+
+//! Dynamixel Protocol v2 status packet check, reporting the alert bit instead of failing on it
+/*!
+ * The alert bit only tells that the motor has a hardware error, the packet itself is valid.
+ * @return false if the crc, the instruction or the error code is wrong
+ */
+static inline bool checkV2Status(const char *packet, bool& alert)
+{
+    unsigned short responseLength = dynamixelV2::minResponseLength + (uint8_t)packet[dynamixelV2::lengthLSBPos] + ((uint8_t)packet[dynamixelV2::lengthMSBPos] << 8);
+    uint8_t error = (uint8_t)packet[dynamixelV2::responseErrorPos];
+    alert = false;
+
+    if(crc_compute(packet,responseLength) == ((uint8_t)packet[responseLength]+((uint8_t)packet[responseLength+1] << 8))
+       && (uint8_t)packet[dynamixelV2::instructionPos] == dynamixelV2::statusInstruction)
+    {
+        alert = error & dynamixelV2::alertBit;
+        return(!(error & ~dynamixelV2::alertBit));
+    }
+    return(false);
+}
+
+#endif //DYNAMIXEL_UTILS_H
\ No newline at end of file
@@ -0,0 +1,119 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#include "EffortLoop.h"
+
+EffortLoop::EffortLoop(DynamixelManager& manager, uint8_t jointCount)
+        : manager(manager),
+          syncRead(manager, jointCount, XL430JointStateBlock::address, XL430JointStateBlock::length),
+          syncWrite(manager, jointCount, XL430Registers::GoalPWM::address),
+          jointCount(min(jointCount, (uint8_t)DYN_MAX_MOTORS)), law(nullptr), lawContext(nullptr)
+{
+    memset(ids, 0, sizeof(ids));
+    memset(states, 0, sizeof(states));
+    memset(commands, 0, sizeof(commands));
+}
+
+EffortLoop::~EffortLoop()
+{
+    stop();
+}
+
+void EffortLoop::setJointID(uint8_t joint, uint8_t id)
+{
+    if(joint >= jointCount)
+    {
+        return;
+    }
+    ids[joint] = id;
+    syncRead.setMotorID(joint, id);
+    syncWrite.setMotorID(joint, id);
+}
+
+void EffortLoop::setControlLaw(EffortLawType* law, void* context)
+{
+    this->law = law;
+    lawContext = context;
+}
+
+bool EffortLoop::configure()
+{
+    const uint8_t steps[3][2] = {
+            {XL430Registers::TorqueEnable::address, 0},
+            {XL430Registers::OperatingMode::address, PWN_CONTROL_MODE},
+            {XL430Registers::TorqueEnable::address, 1},
+    };
+
+    for(uint8_t step = 0; step < 3; step++)
+    {
+        StaticSyncWrite<DYN_MAX_MOTORS, 1> write(manager, jointCount, steps[step][0]);
+        char* data = write.getData();
+        for(uint8_t joint = 0; joint < jointCount; joint++)
+        {
+            write.setMotorID(joint, ids[joint]);
+            data[joint] = (char)steps[step][1];
+        }
+        // Goal PWM must not be sent to motors left in another mode
+        if(!write.send())
+        {
+            return(false);
+        }
+    }
+
+    for(uint8_t joint = 0; joint < jointCount; joint++)
+    {
+        DynamixelMotor* motor = manager.getMotor(ids[joint]);
+        if(motor)
+        {
+            motor->invalidateShadow();
+        }
+    }
+    return(true);
+}
+
+bool EffortLoop::start()
+{
+    stop();
+    return(manager.addCycleTask(&EffortLoop::runCycle, this));
+}
+
+void EffortLoop::stop()
+{
+    manager.removeCycleTask(&EffortLoop::runCycle, this);
+}
+
+void EffortLoop::runCycle(void* loop)
+{
+    ((EffortLoop*)loop)->update();
+}
+
+bool EffortLoop::update()
+{
+    bool status = syncRead.readRecords<XL430JointStateBlock>(states);
+    uint32_t timestamp = micros();
+
+    const uint8_t* statuses = syncRead.getStatus();
+    char* data = syncWrite.getData();
+    for(uint8_t joint = 0; joint < jointCount; joint++)
+    {
+        // Stale feedback must not drive the motor: it goes limp until it answers again
+        bool valid = statuses[joint] & READ_OK;
+        commands[joint] = (valid && law) ? law(lawContext, joint, states[joint], timestamp) : 0;
+        XL430Registers::GoalPWM::store(data + joint*XL430Registers::GoalPWM::length, commands[joint]);
+    }
+
+    syncWrite.prepareFrame();
+    syncWrite.sendFrame();
+    return(status);
+}
+
+const XL430JointState& EffortLoop::getState(uint8_t joint) const
+{
+    return(states[joint < jointCount ? joint : 0]);
+}
+
+int16_t EffortLoop::getCommand(uint8_t joint) const
+{
+    return(joint < jointCount ? commands[joint] : 0);
+}
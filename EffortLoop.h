@@ -0,0 +1,97 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#ifndef DYNAMIXEL_EFFORT_LOOP_H
+#define DYNAMIXEL_EFFORT_LOOP_H
+
+#include "Arduino.h"
+#include "DynamixelManager.h"
+#include "SyncRead.h"
+#include "SyncWrite.h"
+#include "XL430.h"
+
+/*!
+ * Control law of a single joint, evaluated at each cycle of an EffortLoop
+ * @param joint index of the joint in the loop
+ * @param state present load, velocity and position of the joint, just read
+ * @param timestamp micros() value of the read
+ * @return the Goal PWM of the joint, which the motor clamps to its PWM Limit
+ */
+typedef int16_t EffortLawType(void* context, uint8_t joint, const XL430JointState& state, uint32_t timestamp);
+
+//! High rate PWM control of a set of XL430 joints, for compliant and force-controlled behaviours
+/*!
+ * Each update() is one SyncRead of present load, velocity and position (126 to 135) for every joint, the control law
+ * of each joint, then one double-buffered SyncWrite of Goal PWM, sent while the next cycle starts. The XL430 has no
+ * current sensor nor Goal Current: Present Load is the feedback and PWM the command.
+ * <br>Once started, update() is a cycle task of the manager: it runs at the start of every processQueue(), before the
+ * queued control transactions, and background traffic only gets the slack it leaves in the cycle.
+ * <br>A cycle carries about 12 + 21*n bytes of answers and 14 + 3*n bytes of instructions for n joints: running at
+ * 1 kHz or more requires a baudrate of 2 Mbps or more and a null return delay.
+ */
+class EffortLoop {
+
+public:
+
+    EffortLoop(DynamixelManager&, uint8_t jointCount);
+
+    ~EffortLoop();
+
+    EffortLoop(const EffortLoop&) = delete;
+    EffortLoop& operator=(const EffortLoop&) = delete;
+
+    //! Sets the motor ID of a joint
+    void setJointID(uint8_t joint, uint8_t id);
+
+    //! Sets the law evaluated for every joint at each update()
+    void setControlLaw(EffortLawType*, void* context);
+
+    /*!
+     * Switches every joint to PWM control, with one SyncWrite per step: torque off, operating mode, torque on
+     * <br>Operating mode is in the EEPROM area, the cached operating mode of the registered motors is forgotten.
+     * @return false if a step could not be sent, the loop must not be started then
+     */
+    bool configure();
+
+    /*!
+     * Registers update() as a cycle task of the manager, call configure() first and only start if it succeeded
+     * @return false if the manager has no room left for another cycle task
+     */
+    bool start();
+
+    //! Unregisters update() from the manager cycle, the joints keep their last Goal PWM
+    void stop();
+
+    /*!
+     * Runs one cycle: read, control law, write, normally called by the manager once start()ed
+     * <br>A joint which did not answer properly is not given to the law, its Goal PWM is set to 0.
+     * @return false if any joint did not answer properly
+     */
+    bool update();
+
+    //! Last state read for a joint
+    const XL430JointState& getState(uint8_t joint) const;
+
+    //! Last Goal PWM sent to a joint
+    int16_t getCommand(uint8_t joint) const;
+
+private:
+
+    //! Cycle task of the manager
+    static void runCycle(void* loop);
+
+    DynamixelManager& manager;
+    StaticSyncRead<DYN_MAX_MOTORS> syncRead;
+    StaticSyncWrite<DYN_MAX_MOTORS, XL430Registers::GoalPWM::length> syncWrite;
+    uint8_t ids[DYN_MAX_MOTORS];
+    uint8_t jointCount;
+
+    EffortLawType* law;
+    void* lawContext;
+
+    XL430JointState states[DYN_MAX_MOTORS];
+    int16_t commands[DYN_MAX_MOTORS];
+};
+
+#endif //DYNAMIXEL_EFFORT_LOOP_H
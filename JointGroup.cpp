@@ -0,0 +1,190 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#include "JointGroup.h"
+#include "SyncRead.h"
+#include "SyncWrite.h"
+
+JointGroup::JointGroup(const DynamixelManager& manager, const uint8_t* ids, uint8_t count)
+        : manager(manager), jointCount(min(count, (uint8_t)DYN_MAX_MOTORS)), timeBasedProfile(false), expectedArrival(0),
+          goalsKnown(false), settleStatesValid(false)
+{
+    memcpy(this->ids, ids, jointCount);
+    memset(settleStates, 0, sizeof(settleStates));
+}
+
+void JointGroup::setTimeBasedProfile(bool state)
+{
+    timeBasedProfile = state;
+}
+
+bool JointGroup::moveTo(const float* anglesDegree, uint32_t durationMs, uint32_t accelerationMs)
+{
+    int32_t goals[DYN_MAX_MOTORS];
+    for(uint8_t joint = 0; joint < jointCount; joint++)
+    {
+        goals[joint] = unitsToValue(anglesDegree[joint], XL430::angleConversionFactor, XL430Registers::GoalPosition::length);
+    }
+    return(moveToRaw(goals, durationMs, accelerationMs));
+}
+
+bool JointGroup::moveToRaw(const int32_t* goals, uint32_t durationMs, uint32_t accelerationMs)
+{
+    int32_t positions[DYN_MAX_MOTORS];
+    if(!timeBasedProfile)
+    {
+        StaticSyncRead<DYN_MAX_MOTORS> syncRead(manager, jointCount, XL430Registers::PresentPosition::access());
+        for(uint8_t joint = 0; joint < jointCount; joint++)
+        {
+            syncRead.setMotorID(joint, ids[joint]);
+        }
+        if(!syncRead.read<XL430Registers::PresentPosition>(positions))
+        {
+            return(false);
+        }
+    }
+
+    StaticSyncWrite<DYN_MAX_MOTORS, XL430MotionBlock::length> syncWrite(manager, jointCount, XL430MotionBlock::address);
+    char* data = syncWrite.getData();
+    for(uint8_t joint = 0; joint < jointCount; joint++)
+    {
+        XL430Motion motion = timeBasedProfile ? XL430::timeBasedMotion(goals[joint], durationMs, accelerationMs)
+                                              : XL430::velocityBasedMotion(positions[joint], goals[joint], durationMs, accelerationMs);
+        XL430MotionBlock::store(data + joint*XL430MotionBlock::length, motion);
+        syncWrite.setMotorID(joint, ids[joint]);
+    }
+
+    if(!syncWrite.send())
+    {
+        return(false);
+    }
+    expectedArrival = micros() + durationMs*1000;
+    memcpy(this->goals, goals, jointCount*sizeof(int32_t));
+    goalsKnown = true;
+    return(true);
+}
+
+uint8_t JointGroup::getJointCount() const
+{
+    return(jointCount);
+}
+
+uint8_t JointGroup::getID(uint8_t joint) const
+{
+    return(joint < jointCount ? ids[joint] : 0);
+}
+
+uint32_t JointGroup::getExpectedArrival() const
+{
+    return(expectedArrival);
+}
+
+bool JointGroup::isSettled()
+{
+    StaticSyncRead<DYN_MAX_MOTORS> syncRead(manager, jointCount, XL430SettleBlock::access());
+    for(uint8_t joint = 0; joint < jointCount; joint++)
+    {
+        syncRead.setMotorID(joint, ids[joint]);
+    }
+    settleStatesValid = syncRead.readRecords<XL430SettleBlock>(settleStates);
+    if(!settleStatesValid)
+    {
+        return(false);
+    }
+
+    for(uint8_t joint = 0; joint < jointCount; joint++)
+    {
+        if((settleStates[joint].movingStatus & (IN_POSITION | PROFILE_ONGOING)) != IN_POSITION)
+        {
+            return(false);
+        }
+    }
+    return(true);
+}
+
+bool JointGroup::waitUntilSettled(uint32_t timeoutMs)
+{
+    uint32_t start = micros();
+    uint32_t timeout = timeoutMs*1000;
+
+    // Polling before the expected arrival would only waste bus time
+    uint32_t next = expectedArrival;
+    if((int32_t)(next - start) < 0)
+    {
+        next = start;
+    }
+    else if(next - start > timeout)
+    {
+        next = start + timeout;
+    }
+
+    while(true)
+    {
+        uint32_t now = micros();
+        if((int32_t)(next - now) > 0)
+        {
+            uint32_t wait = next - now;
+            delay(wait/1000);
+            delayMicroseconds(wait%1000);
+        }
+
+        if(isSettled())
+        {
+            return(true);
+        }
+
+        now = micros();
+        if(now - start >= timeout)
+        {
+            return(false);
+        }
+        uint32_t wait = min(nextPollDelay(now), timeout - (now - start));
+        next = now + wait;
+    }
+}
+
+uint32_t JointGroup::nextPollDelay(uint32_t now) const
+{
+    if(!settleStatesValid)
+    {
+        return(DYN_SETTLE_POLL_PERIOD);
+    }
+
+    // Motors still running their profile are not done before its expected end
+    bool profileOngoing = false;
+    for(uint8_t joint = 0; joint < jointCount; joint++)
+    {
+        profileOngoing |= (settleStates[joint].movingStatus & PROFILE_ONGOING) != 0;
+    }
+    if(profileOngoing && (int32_t)(expectedArrival - now) > DYN_SETTLE_POLL_PERIOD)
+    {
+        return(expectedArrival - now);
+    }
+    if(!goalsKnown)
+    {
+        return(DYN_SETTLE_POLL_PERIOD);
+    }
+
+    // Otherwise, the time the slowest joint needs to cover its remaining error at its present velocity
+    uint32_t wait = DYN_SETTLE_POLL_PERIOD;
+    for(uint8_t joint = 0; joint < jointCount; joint++)
+    {
+        const XL430SettleState& state = settleStates[joint];
+        int64_t error = (int64_t)goals[joint] - state.position;
+        int64_t velocity = state.velocity;
+        if((state.movingStatus & IN_POSITION) || velocity == 0 || (error < 0) != (velocity < 0))
+        {
+            continue;
+        }
+        // Ticks of angleFixedScale millidegrees, at velocity units of velocityFixedScale milli-rpm
+        int64_t remaining = error*XL430::angleFixedScale*1000000/(velocity*XL430::velocityFixedScale*6);
+        wait = (uint32_t)max((int64_t)wait, min(remaining, (int64_t)UINT32_MAX));
+    }
+    return(wait);
+}
+
+uint8_t JointGroup::getMovingStatus(uint8_t joint) const
+{
+    return(joint < jointCount ? settleStates[joint].movingStatus : 0);
+}
@@ -0,0 +1,95 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#ifndef DYNAMIXEL_JOINT_GROUP_H
+#define DYNAMIXEL_JOINT_GROUP_H
+
+#include "Arduino.h"
+#include "DynamixelManager.h"
+#include "XL430.h"
+
+#ifndef DYN_SETTLE_POLL_PERIOD
+#define DYN_SETTLE_POLL_PERIOD 2000     //!< Shortest time, in microseconds, between two Moving Status reads
+#endif
+
+//! Set of XL430 joints moving together
+/*!
+ * A move gives every joint the profile that makes it reach its target after the same duration, and commits all of
+ * them with a single SyncWrite of the Profile Acceleration, Profile Velocity and Goal Position block: joints start and
+ * arrive together.
+ * <br>With time-based profiles, every joint simply gets the same durations. With velocity-based profiles (the XL430
+ * default), the present positions are read with a single SyncRead to compute each joint velocity and acceleration.
+ * <br>Arrival is detected with a single SyncRead of Moving Status to Present Position for the whole group, which is
+ * only polled around the expected end of the move.
+ */
+class JointGroup {
+
+public:
+
+    JointGroup(const DynamixelManager&, const uint8_t* ids, uint8_t count);
+
+    /*!
+     * Whether the joints use time-based profiles, false by default.
+     * \sa XL430::setTimeBasedProfile() to configure the motors themselves
+     */
+    void setTimeBasedProfile(bool);
+
+    /*!
+     * Moves every joint to its angle, all of them arriving after durationMs
+     * @param accelerationMs acceleration (and deceleration) time of every joint, at most half of the duration
+     * @return false if the present positions could not be read (velocity-based profiles) or the SyncWrite not sent
+     */
+    bool moveTo(const float* anglesDegree, uint32_t durationMs, uint32_t accelerationMs);
+
+    //! Same as moveTo(), with goals in encoder ticks
+    bool moveToRaw(const int32_t* goals, uint32_t durationMs, uint32_t accelerationMs);
+
+    uint8_t getJointCount() const;
+
+    uint8_t getID(uint8_t joint) const;
+
+    //! micros() value at which the last move should be done
+    uint32_t getExpectedArrival() const;
+
+    /*!
+     * \name Arrival detection
+     */
+    //!@{
+
+    /*!
+     * Reads Moving Status, present velocity and position of every joint with a single SyncRead (XL430SettleBlock)
+     * @return true if every joint is in position with its profile done, false if not or if the read failed
+     */
+    bool isSettled();
+
+    /*!
+     * Waits until isSettled(), for at most timeoutMs. Nothing is read before the expected arrival of the last move
+     * (or the timeout if it comes first). The group is then polled again once the profiles should be done, or once the
+     * slowest joint should have covered its remaining error at its present velocity, and at most every
+     * DYN_SETTLE_POLL_PERIOD. Each poll is the single SyncRead of isSettled().
+     * @return false on timeout
+     */
+    bool waitUntilSettled(uint32_t timeoutMs);
+
+    //! Moving Status of a joint, as of the last isSettled()
+    uint8_t getMovingStatus(uint8_t joint) const;
+    //!@}
+
+private:
+
+    //! Time to wait, in microseconds, before polling a group which is not settled yet, from the last isSettled() read
+    uint32_t nextPollDelay(uint32_t now) const;
+
+    const DynamixelManager& manager;
+    uint8_t ids[DYN_MAX_MOTORS];
+    uint8_t jointCount;
+    bool timeBasedProfile;
+    uint32_t expectedArrival;
+    int32_t goals[DYN_MAX_MOTORS];          //!< Goal positions of the last move
+    bool goalsKnown;
+    XL430SettleState settleStates[DYN_MAX_MOTORS];
+    bool settleStatesValid;                 //!< Whether every joint answered the last isSettled()
+};
+
+#endif //DYNAMIXEL_JOINT_GROUP_H
@@ -4,19 +4,50 @@
 
 #include "SyncRead.h"
 
-SyncRead::SyncRead(const DynamixelManager& manager, const unsigned int motorCount, const DynamixelAccessData& data): manager(manager), motorCount(motorCount), address((uint16_t ) (data.address[0] | (data.address[1] << 8))), length(data.length) {
+SyncRead::SyncRead(const DynamixelManager& manager, const unsigned int motorCount, const DynamixelAccessData& data): manager(manager), address((uint16_t ) (data.address[0] | (data.address[1] << 8))), length(data.length), motorCount(motorCount) {
     motors = new uint8_t[motorCount];
+    statuses = new uint8_t[motorCount];
+    slots = nullptr;
+    ownsStorage = true;
 }
 
-SyncRead::SyncRead(const DynamixelManager& manager, const unsigned int motorCount, const uint16_t address, const uint16_t length): manager(manager), motorCount(motorCount), address(address), length(length) {
+SyncRead::SyncRead(const DynamixelManager& manager, const unsigned int motorCount, const uint16_t address, const uint16_t length): manager(manager), address(address), length(length), motorCount(motorCount) {
     motors = new uint8_t[motorCount];
+    statuses = new uint8_t[motorCount];
+    slots = nullptr;
+    ownsStorage = true;
+}
+
+SyncRead::SyncRead(const DynamixelManager& manager, const unsigned int motorCount, const uint16_t address, const uint16_t length, uint8_t* motorStorage, uint8_t* statusStorage, uint8_t* slotStorage): manager(manager), address(address), length(length), motorCount(motorCount) {
+    motors = motorStorage;
+    statuses = statusStorage;
+    slots = slotStorage;
+    ownsStorage = false;
+}
+
+SyncRead::~SyncRead() {
+    if(ownsStorage) {
+        delete[] motors;
+        delete[] statuses;
+    }
 }
 
 void SyncRead::setMotorID(unsigned int index, uint8_t id) {
+    if(index >= motorCount) {
+        return;
+    }
+    // The previous ID of this index no longer maps to it
+    uint8_t previous = motors[index];
+    if(slots && previous < DYN_ID_SLOTS && slots[previous] == index) {
+        slots[previous] = (uint8_t) motorCount;
+    }
     motors[index] = id;
+    if(slots && id < DYN_ID_SLOTS) {
+        slots[id] = (uint8_t) index;
+    }
 }
 
-DynamixelPacketData* SyncRead::preparePacket() {
+DynamixelPacketData* SyncRead::preparePacket(bool fast) {
     char* packet = manager.txBuffer;
     unsigned int instrLength =  2 /* CRC */ + 2 /* Address */ + 2 /* Length */ + 1 /* Instruction */ + motorCount /* IDs */;
     uint8_t packetSize = (uint8_t) (instrLength + 4 /* header*/ + 1 /* id */ + 2 /* packet length */);
@@ -28,7 +59,7 @@ DynamixelPacketData* SyncRead::preparePacket() {
     packet[position++] = dynamixelV2::broadcastId;
     packet[position++] = instrLength & 0xFF;
     packet[position++] = (instrLength >> 8) & 0xFF;
-    packet[position++] = dynamixelV2::syncReadInstruction;
+    packet[position++] = fast ? dynamixelV2::fastSyncReadInstruction : dynamixelV2::syncReadInstruction;
 
     packet[position++] = address & 0xFF;
     packet[position++] = (address >> 8) & 0xFF;
@@ -47,27 +78,161 @@ DynamixelPacketData* SyncRead::preparePacket() {
     return(new DynamixelPacketData(packetSize, 0)); // size is 0, special case as there are 'motorCount' answers
 }
 
+namespace {
+    struct CopyContext {
+        char* result;
+        uint16_t length;
+    };
+
+    struct CallbackContext {
+        TransactionCallbackType* callback;
+        void* context;
+        const uint8_t* motors;
+        uint16_t length;
+    };
+
+    void copyReply(void* context, unsigned int index, uint8_t, const char* parameters) {
+        CopyContext* copy = (CopyContext*) context;
+        if(parameters) {
+            memcpy(copy->result + index*copy->length, parameters, copy->length);
+        }
+    }
+
+    void forwardReply(void* context, unsigned int index, uint8_t status, const char* parameters) {
+        CallbackContext* forward = (CallbackContext*) context;
+        forward->callback(forward->context, forward->motors[index], status & READ_OK, parameters, forward->length);
+    }
+}
+
 bool SyncRead::read(char* result) {
+    CopyContext context = {result, length};
+    return readReplies(&copyReply, &context);
+}
+
+bool SyncRead::read(TransactionCallbackType* callback, void* context) {
+    CallbackContext forward = {callback, context, motors, length};
+    return readReplies(&forwardReply, &forward);
+}
+
+const uint8_t* SyncRead::getStatus() const {
+    return statuses;
+}
+
+bool SyncRead::readReplies(ReplyHandlerType* handler, void* context) {
+    memset(statuses, 0, motorCount);
+
+    unsigned int fastPacketSize = 4/*header*/ + 1 /* ID */ + 2 /* Length */ + 1 /* Instruction */ + (4 + length)*motorCount;
+    if(manager.useFastSyncRead() && fastPacketSize <= DYN_BUFFER_SIZE && fastPacketSize <= 0xFF) {
+        return readFastReplies(handler, context);
+    }
+
     uint16_t expectedPacketSize = 4/*header*/ + 1 /* ID */ + 2 /* Length */ + 1 /* Instruction */ + 1 /* Error */ + (uint16_t)length /* Parameter */ + 2 /* CRC */;
+    // Motors answer one after the other, the k-th answer is expected k slots after the instruction
+    uint32_t slot = manager.estimateTransactionTime(0, expectedPacketSize);
     manager.sendPacket(preparePacket());
-    for(uint8_t i = 0; i < motorCount; i++) {
-        char* response = manager.readPacket(expectedPacketSize);
-        // TODO: check validity with CRC
-        uint8_t motorID = (uint8_t)response[dynamixelV2::idPos];
+    uint32_t start = micros();
+
+    for(unsigned int i = 0; i < motorCount; i++) {
+        uint8_t received;
+        char* response = manager.readPacketBefore((uint8_t) expectedPacketSize, start + (i+1)*slot + DYN_READ_MARGIN, received);
+        if(received < expectedPacketSize) {
+            // The bytes of the next answers may already be there, readPacketBefore() finds them by their header
+            continue;
+        }
 
-        // find corresponding index
         // it is possible that the packets are out of order (the datasheet makes no guarantee)
-        uint8_t index = 0;
-        for(uint8_t subId = 0; subId < motorCount; subId++) {
-            if(motors[subId] == motorID) {
-                index = subId;
-                break;
-            }
+        unsigned int index = indexOf((uint8_t)response[dynamixelV2::idPos]);
+        if(index >= motorCount || (statuses[index] & READ_OK)) {
+            continue;
+        }
+
+        unsigned short crc = crc_compute(response, expectedPacketSize-2);
+        if(((uint8_t)response[expectedPacketSize-2] | ((uint8_t)response[expectedPacketSize-1] << 8)) != crc
+           || (uint8_t)response[dynamixelV2::instructionPos] != dynamixelV2::statusInstruction) {
+            // The ID itself may be corrupted, this is a best effort attribution
+            statuses[index] |= READ_CRC_ERROR;
+            continue;
+        }
+
+        uint8_t error = (uint8_t)response[dynamixelV2::responseErrorPos];
+        if(error & ~dynamixelV2::alertBit) {
+            statuses[index] |= READ_STATUS_ERROR;
+            continue;
+        }
+        statuses[index] = READ_OK | ((error & dynamixelV2::alertBit) ? READ_ALERT : 0);
+        manager.noteAlert(motors[index], error & dynamixelV2::alertBit);
+        handler(context, index, statuses[index], response + dynamixelV2::responseParameterStart);
+    }
+
+    // Late answers must not be mistaken for the next ones
+    manager.flushInput();
+    return notifyFailures(handler, context);
+}
+
+bool SyncRead::readFastReplies(ReplyHandlerType* handler, void* context) {
+    // Every motor appends [Error | ID | Data | CRC] to the same status packet, the last CRC covering the whole packet
+    unsigned int blockLength = 1 /* Error */ + 1 /* ID */ + length /* Parameter */ + 2 /* CRC */;
+    unsigned int expectedPacketSize = 4/*header*/ + 1 /* ID */ + 2 /* Length */ + 1 /* Instruction */ + blockLength*motorCount;
+    uint32_t duration = manager.estimateTransactionTime(0, expectedPacketSize);
+    manager.sendPacket(preparePacket(true));
+    uint32_t start = micros();
+
+    uint8_t received;
+    char* response = manager.readPacketBefore((uint8_t) expectedPacketSize, start + duration + DYN_READ_MARGIN, received);
+    if(received < expectedPacketSize) {
+        manager.flushInput();
+        memset(statuses, READ_TIMEOUT, motorCount);
+        return notifyFailures(handler, context);
+    }
+
+    unsigned short crc = crc_compute(response, expectedPacketSize-2);
+    if(((uint8_t)response[expectedPacketSize-2] | ((uint8_t)response[expectedPacketSize-1] << 8)) != crc) {
+        memset(statuses, READ_CRC_ERROR, motorCount);
+        return notifyFailures(handler, context);
+    }
+
+    for(unsigned int block = 0; block < motorCount; block++) {
+        const char* blockStart = response + dynamixelV2::responseErrorPos + block*blockLength;
+        unsigned int index = indexOf((uint8_t)blockStart[1]);
+        if(index >= motorCount) {
+            continue;
         }
+        uint8_t error = (uint8_t)blockStart[0];
+        if(error & ~dynamixelV2::alertBit) {
+            statuses[index] |= READ_STATUS_ERROR;
+            continue;
+        }
+        statuses[index] = READ_OK | ((error & dynamixelV2::alertBit) ? READ_ALERT : 0);
+        manager.noteAlert(motors[index], error & dynamixelV2::alertBit);
+        handler(context, index, statuses[index], blockStart+2);
+    }
 
-        for (uint8_t byteIndex = 0; byteIndex < length; byteIndex++) {
-            result[index*length+byteIndex] = response[dynamixelV2::responseParameterStart+byteIndex];
+    return notifyFailures(handler, context);
+}
+
+bool SyncRead::notifyFailures(ReplyHandlerType* handler, void* context) {
+    bool allValid = true;
+    for(unsigned int index = 0; index < motorCount; index++) {
+        if(statuses[index] & READ_OK) {
+            continue;
+        }
+        if(statuses[index] == 0) {
+            statuses[index] = READ_TIMEOUT;
         }
+        allValid = false;
+        handler(context, index, statuses[index], nullptr);
     }
-    return true;// TODO return decapsulatePacket(returnPacket);
-}
\ No newline at end of file
+    return allValid;
+}
+
+unsigned int SyncRead::indexOf(uint8_t motorID) const {
+    if(slots) {
+        return motorID < DYN_ID_SLOTS ? slots[motorID] : motorCount;
+    }
+    for(unsigned int subId = 0; subId < motorCount; subId++) {
+        if(motors[subId] == motorID) {
+            return subId;
+        }
+    }
+    return motorCount;
+}
@@ -6,14 +6,23 @@
 #define DYNAMIXEL_COM_SYNCREAD_H
 
 #include "DynamixelManager.h"
+#include "DynamixelRegister.h"
+#include <array>
 
 /**
  * This class represents a Sync Read instruction. It is mutable to avoid reallocating objects and because the number of motors is unlikely to change during runtime
+ * <br>Every answer is validated in place (CRC, status instruction, error) and decoded straight from the reception
+ * buffer. Each motor has its own deadline, a missing motor only costs its own time slot. The ReadStatus of each motor
+ * is available through getStatus() after each read.
  */
 class SyncRead {
 public:
     SyncRead(const DynamixelManager &, unsigned int, uint16_t, uint16_t);
     SyncRead(const DynamixelManager &, unsigned int, const DynamixelAccessData& data);
+    ~SyncRead();
+
+    SyncRead(const SyncRead&) = delete;
+    SyncRead& operator=(const SyncRead&) = delete;
 
     /**
      * Sets up the motor IDs in the chain
@@ -22,20 +31,115 @@ public:
 
     /**
  * Creates the packet for sending (in DynamixelManager#txBuffer !!)
+ * @param fast whether to use the Fast Sync Read instruction
  * @return
  */
-    DynamixelPacketData* preparePacket();
+    DynamixelPacketData* preparePacket(bool fast = false);
 
     /**
      * Send a Sync Read instruction and read the answers into the given buffer.
      * Struction example with 2 motors:
      * [Motor at Index 0, Byte 0 | Motor at Index 0, Byte 1 | Motor at Index 1, Byte 0 | Motor at Index 1, Byte 1]
-     * @return
+     * <br>Fast Sync Read is used instead when the manager sheds load with SHED_FAST_SYNC_READ and the combined
+     * answer fits in its reception buffer.
+     * <br>The result can be converted in a single pass with convertToUnits.
+     * @return false if any motor did not answer properly, the data of these motors is left untouched
      */
     bool read(char*);
 
+    /**
+     * Send a Sync Read instruction and decode the register of each motor into the given array, by motor index
+     * @return false if any motor did not answer properly, or if the register is not the one read
+     */
+    template<typename Reg>
+    bool read(typename Reg::type* values)
+    {
+        if(Reg::address != address || Reg::length != length) {
+            return false;
+        }
+        return readReplies(&SyncRead::decodeRegister<Reg>, values);
+    }
+
+    /**
+     * Send a Sync Read instruction and decode the register block of each motor into the given records, by motor index,
+     * e.g. a XL430JointState per motor for a read of XL430JointStateBlock
+     * @return false if any motor did not answer properly, or if the block is not the area read
+     */
+    template<typename Block>
+    bool readRecords(typename Block::record_type* records)
+    {
+        if(Block::address != address || Block::length != length) {
+            return false;
+        }
+        return readReplies(&SyncRead::decodeBlock<Block>, records);
+    }
+
+    /**
+     * Send a Sync Read instruction and give each answer to the callback, directly from the reception buffer.
+     * The status given to the callback is false if the answer is corrupted or missing. The alert bit does not make an
+     * answer invalid, it is recorded by the manager (see DynamixelManager::noteAlert()).
+     * @return false if any answer is invalid
+     */
+    bool read(TransactionCallbackType*, void*);
+
+    /**
+     * ReadStatus bitmask of each motor, by index, for the last read
+     */
+    const uint8_t* getStatus() const;
+
+protected:
+    /**
+     * Uses the given storage instead of allocating it: motorCount IDs and statuses, and an optional ID to index table
+     * of DYN_ID_SLOTS entries, filled by setMotorID()
+     */
+    SyncRead(const DynamixelManager &, unsigned int, uint16_t, uint16_t, uint8_t*, uint8_t*, uint8_t*);
+
 private:
-    DynamixelManager manager;
+    /**
+     * Called for each answer, with its parameters still in the reception buffer. parameters is nullptr if the motor
+     * did not answer properly.
+     */
+    typedef void ReplyHandlerType(void* context, unsigned int index, uint8_t status, const char* parameters);
+
+    /**
+     * Sends the instruction and reads every answer, filling the statuses and calling the handler
+     * @return true if every motor answered properly
+     */
+    bool readReplies(ReplyHandlerType*, void*);
+
+    /**
+     * Reads the single status packet of a Fast Sync Read
+     */
+    bool readFastReplies(ReplyHandlerType*, void*);
+
+    /**
+     * Marks the motors without any status as timed out, and calls the handler for every motor that failed
+     * @return true if every motor answered properly
+     */
+    bool notifyFailures(ReplyHandlerType*, void*);
+
+    template<typename Reg>
+    static void decodeRegister(void* values, unsigned int index, uint8_t, const char* parameters)
+    {
+        if(parameters) {
+            ((typename Reg::type*) values)[index] = Reg::load(parameters);
+        }
+    }
+
+    template<typename Block>
+    static void decodeBlock(void* records, unsigned int index, uint8_t, const char* parameters)
+    {
+        if(parameters) {
+            Block::load(parameters, ((typename Block::record_type*) records)[index]);
+        }
+    }
+
+    /**
+     * Index of the given motor ID in the chain, motorCount if it is not part of it
+     */
+    unsigned int indexOf(uint8_t) const;
+
+    const DynamixelManager& manager;
 
     /**
      * Start address of area to write
@@ -53,7 +157,43 @@ private:
      * The ids of the motors in chain
      */
     uint8_t* motors;
+    /**
+     * ReadStatus of each motor in chain
+     */
+    uint8_t* statuses;
+    /**
+     * Index of each motor ID in the chain, nullptr to search the IDs instead
+     */
+    uint8_t* slots;
+    /**
+     * Whether the arrays were allocated by this instance
+     */
+    bool ownsStorage;
+
+};
+
+/**
+ * Sync Read of at most Capacity motors, without any heap allocation. Answers are mapped to their motor index with a
+ * lookup table instead of a search through the IDs.
+ */
+template<unsigned int Capacity>
+class StaticSyncRead : public SyncRead {
+public:
+    StaticSyncRead(const DynamixelManager& manager, unsigned int motorCount, uint16_t address, uint16_t length)
+            : SyncRead(manager, motorCount < Capacity ? motorCount : Capacity, address, length, motorStorage.data(), statusStorage.data(), slotStorage.data()) {
+        slotStorage.fill(Capacity);
+    }
+
+    StaticSyncRead(const DynamixelManager& manager, unsigned int motorCount, const DynamixelAccessData& data)
+            : StaticSyncRead(manager, motorCount, (uint16_t) (data.address[0] | (data.address[1] << 8)), data.length) {
+    }
+
+private:
+    static_assert(Capacity < 0xFF, "Motor indices are stored on a byte");
 
+    std::array<uint8_t, Capacity> motorStorage;
+    std::array<uint8_t, Capacity> statusStorage;
+    std::array<uint8_t, DYN_ID_SLOTS> slotStorage;
 };
 
 
@@ -6,28 +6,66 @@
 #include "SyncWrite.h"
 #include "DynamixelManager.h"
 
-SyncWrite::SyncWrite(const DynamixelManager& manager, const unsigned int motorCount, const DynamixelAccessData& data): manager(manager), motorCount(motorCount), address((uint16_t ) (data.address[0] | (data.address[1] << 8))), length(data.length) {
+SyncWrite::SyncWrite(const DynamixelManager& manager, const unsigned int motorCount, const DynamixelAccessData& data): manager(manager), address((uint16_t ) (data.address[0] | (data.address[1] << 8))), length(data.length), motorCount(motorCount) {
     motors = new uint8_t[motorCount];
     rawData = new char[motorCount*length];
+    frames = new char[2*frameSize(motorCount, length)];
+    backFrame = 0;
+    backFrameSize = 0;
+    ownsStorage = true;
 }
 
-SyncWrite::SyncWrite(const DynamixelManager& manager, const unsigned int motorCount, const uint16_t address, const uint16_t length): manager(manager), motorCount(motorCount), address(address), length(length) {
+SyncWrite::SyncWrite(const DynamixelManager& manager, const unsigned int motorCount, const uint16_t address, const uint16_t length): manager(manager), address(address), length(length), motorCount(motorCount) {
     motors = new uint8_t[motorCount];
     rawData = new char[motorCount*length];
+    frames = new char[2*frameSize(motorCount, length)];
+    backFrame = 0;
+    backFrameSize = 0;
+    ownsStorage = true;
+}
+
+SyncWrite::SyncWrite(const DynamixelManager& manager, const unsigned int motorCount, const uint16_t address, const uint16_t length, uint8_t* motorStorage, char* dataStorage, char* frameStorage): manager(manager), address(address), length(length), motorCount(motorCount) {
+    motors = motorStorage;
+    rawData = dataStorage;
+    frames = frameStorage;
+    backFrame = 0;
+    backFrameSize = 0;
+    ownsStorage = false;
+}
+
+SyncWrite::~SyncWrite() {
+    if(ownsStorage) {
+        delete[] motors;
+        delete[] rawData;
+        delete[] frames;
+    }
 }
 
 void SyncWrite::setMotorID(unsigned int index, uint8_t id) {
+    if(index >= motorCount) {
+        return;
+    }
     motors[index] = id;
 }
 
 void SyncWrite::setData(unsigned int motorIndex, char* data) {
+    if(motorIndex >= motorCount) {
+        return;
+    }
     for(unsigned int i = 0;i<length;i++) {
         rawData[motorIndex*length+i] = data[i];
     }
 }
 
+char* SyncWrite::getData() {
+    return rawData;
+}
+
 DynamixelPacketData* SyncWrite::preparePacket() {
-    char* packet = manager.txBuffer;
+    return(new DynamixelPacketData(buildFrame(manager.txBuffer), 0));
+}
+
+uint8_t SyncWrite::buildFrame(char* packet) {
     unsigned int instrLength =  2 /* CRC */ + 2 /* Address */ + 2 /* Length */ + 1 /* Instruction */ + (length+1)*motorCount /* Data */;
     uint8_t packetSize = (uint8_t) (instrLength + 4 /* header*/ + 1 /* id */ + 2 /* packet length */);
     unsigned int position = 0;
@@ -57,10 +95,29 @@ DynamixelPacketData* SyncWrite::preparePacket() {
     packet[position++] = crc & 0xFF;
     packet[position++] = (crc >> 8) & 0xFF;
 
-    return(new DynamixelPacketData(packetSize, 0));
+    return packetSize;
 }
 
 bool SyncWrite::send() {
-    char* returnPacket = manager.sendPacket(preparePacket());
-    return false;// TODO return decapsulatePacket(returnPacket);
-}
\ No newline at end of file
+    // Broadcast instructions get no status packet, only a frame which cannot be built is known to fail
+    if(motorCount == 0 || frameSize(motorCount, length) > DYN_BUFFER_SIZE) {
+        return false;
+    }
+    manager.sendPacket(preparePacket());
+    return true;
+}
+
+uint8_t SyncWrite::prepareFrame() {
+    backFrameSize = buildFrame(frames + backFrame*frameSize(motorCount, length));
+    return backFrameSize;
+}
+
+void SyncWrite::sendFrame() {
+    if(backFrameSize == 0) {
+        return;
+    }
+    manager.sendFrameAsync(frames + backFrame*frameSize(motorCount, length), backFrameSize);
+    // The sent frame stays untouched until the next transmission, the next one is built in the other buffer
+    backFrame ^= 1;
+    backFrameSize = 0;
+}
@@ -8,6 +8,7 @@
 
 #include "DynamixelUtils.h"
 #include "DynamixelManager.h"
+#include <array>
 
 /**
  * This class represents a Sync Write instruction. It is mutable to avoid reallocating objects and because the number of motors is unlikely to change during runtime
@@ -22,6 +23,10 @@ public:
      * @param data
      */
     SyncWrite(const DynamixelManager &, unsigned int, const DynamixelAccessData& data);
+    ~SyncWrite();
+
+    SyncWrite(const SyncWrite&) = delete;
+    SyncWrite& operator=(const SyncWrite&) = delete;
 
     /**
      * Sets up the motor IDs in the chain
@@ -33,6 +38,11 @@ public:
      */
     void setData(unsigned int, char*);
 
+    /**
+     * Data of all motors, packed by index, to fill it in place (e.g. with convertFromUnits)
+     */
+    char* getData();
+
     /**
      * Creates the packet for sending (in DynamixelManager#txBuffer !!)
      * @return
@@ -41,12 +51,51 @@ public:
 
     /**
      * Helper method to directly send a new packet to the manager
-     * @return
+     * @return false if there is no motor or the frame does not fit in the manager buffers. The motors do not answer
+     * a Sync Write, true only means that it was sent.
      */
     bool send();
 
+    /**
+     * \name Double buffering
+     * The frame is built in one of two buffers owned by this instance, and sent without waiting for it to leave the
+     * UART: the next frame can be built while the previous one is still being transmitted.
+     */
+    //!@{
+
+    /**
+     * Builds the frame from the current data, in the buffer which is not being transmitted
+     * @return the frame size
+     */
+    uint8_t prepareFrame();
+
+    /**
+     * Queues the frame built by prepareFrame() for transmission, see DynamixelManager::sendFrameAsync()
+     */
+    void sendFrame();
+    //!@}
+
+    /**
+     * Size of the frame of a Sync Write
+     */
+    static constexpr unsigned int frameSize(unsigned int motorCount, uint16_t length) {
+        return 4 /* header */ + 1 /* id */ + 2 /* packet length */ + 1 /* Instruction */ + 2 /* Address */ + 2 /* Length */ + (length+1)*motorCount /* Data */ + 2 /* CRC */;
+    }
+
+protected:
+    /**
+     * Uses the given storage instead of allocating it: motorCount IDs, motorCount*length data bytes and two frames
+     */
+    SyncWrite(const DynamixelManager &, unsigned int, uint16_t, uint16_t, uint8_t*, char*, char*);
+
 private:
-    DynamixelManager manager;
+    /**
+     * Writes the frame into the given buffer
+     * @return the frame size
+     */
+    uint8_t buildFrame(char*);
+
+    const DynamixelManager& manager;
 
     /**
      * Start address of area to write
@@ -68,6 +117,40 @@ private:
      * The data to write to each motor
      */
     char* rawData;
+    /**
+     * Two frames of frameSize() bytes, one being built while the other one is transmitted
+     */
+    char* frames;
+    /**
+     * Index of the frame built by prepareFrame()
+     */
+    uint8_t backFrame;
+    /**
+     * Size of the frame built by prepareFrame(), 0 if it was already sent
+     */
+    uint8_t backFrameSize;
+    /**
+     * Whether the arrays were allocated by this instance
+     */
+    bool ownsStorage;
+};
+
+/**
+ * Sync Write of at most Capacity motors and Length bytes per motor, without any heap allocation
+ */
+template<unsigned int Capacity, uint16_t Length>
+class StaticSyncWrite : public SyncWrite {
+public:
+    StaticSyncWrite(const DynamixelManager& manager, unsigned int motorCount, uint16_t address)
+            : SyncWrite(manager, motorCount < Capacity ? motorCount : Capacity, address, Length, motorStorage.data(), dataStorage.data(), frameStorage.data()) {
+    }
+
+private:
+    static_assert(frameSize(Capacity, Length) <= 0xFF, "Frame sizes are stored on a byte");
+
+    std::array<uint8_t, Capacity> motorStorage;
+    std::array<char, Capacity*Length> dataStorage;
+    std::array<char, 2*frameSize(Capacity, Length)> frameStorage;
 };
 
 
@@ -0,0 +1,164 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#include "TrajectoryInterpolator.h"
+#include "DynamixelRegister.h"
+
+TrajectoryInterpolator::TrajectoryInterpolator(const DynamixelManager& manager, uint8_t jointCount, const DynamixelAccessData& goal)
+        : syncWrite(manager, jointCount, (uint16_t)(goal.address[0] | (goal.address[1] << 8))),
+          jointCount(min(jointCount, (uint8_t)DYN_MAX_MOTORS))
+{
+    memset(waypointCounts, 0, sizeof(waypointCounts));
+    memset(setpoints, 0, sizeof(setpoints));
+    memset(hasSetpoint, 0, sizeof(hasSetpoint));
+    memset(segmentFrozen, 0, sizeof(segmentFrozen));
+}
+
+void TrajectoryInterpolator::setJointID(uint8_t joint, uint8_t id)
+{
+    syncWrite.setMotorID(joint, id);
+}
+
+bool TrajectoryInterpolator::addWaypoint(uint8_t joint, uint32_t time, int32_t position)
+{
+    if(joint >= jointCount || waypointCounts[joint] >= DYN_MAX_WAYPOINTS)
+    {
+        return(false);
+    }
+
+    uint8_t& count = waypointCounts[joint];
+    if(count > 0 && (int32_t)(time - waypoints[joint][count-1].time) <= 0)
+    {
+        return(false);
+    }
+
+    waypoints[joint][count++] = {time, position};
+    return(true);
+}
+
+void TrajectoryInterpolator::clear(uint8_t joint)
+{
+    if(joint < jointCount)
+    {
+        waypointCounts[joint] = 0;
+        segmentFrozen[joint] = false;
+    }
+}
+
+uint8_t TrajectoryInterpolator::getWaypointCount(uint8_t joint) const
+{
+    return(joint < jointCount ? waypointCounts[joint] : 0);
+}
+
+int32_t TrajectoryInterpolator::slope(uint8_t joint, uint8_t i) const
+{
+    if(i == 0 || i+1 >= waypointCounts[joint])
+    {
+        return(0);
+    }
+
+    const DynamixelWaypoint& previous = waypoints[joint][i-1];
+    const DynamixelWaypoint& current = waypoints[joint][i];
+    const DynamixelWaypoint& next = waypoints[joint][i+1];
+
+    // Stops on local extrema and plateaus
+    int64_t before = (((int64_t)current.position - previous.position) << 16) / (uint32_t)(current.time - previous.time);
+    int64_t after = (((int64_t)next.position - current.position) << 16) / (uint32_t)(next.time - current.time);
+    if(before == 0 || after == 0 || (before < 0) != (after < 0))
+    {
+        return(0);
+    }
+
+    // Within three times the slope of both segments, each of them stays monotone (Fritsch-Carlson)
+    int64_t value = (((int64_t)next.position - previous.position) << 16) / (uint32_t)(next.time - previous.time);
+    int64_t limit = 3*min(abs(before), abs(after));
+    value = max(-limit, min(value, limit));
+    return((int32_t)max((int64_t)INT32_MIN, min(value, (int64_t)INT32_MAX)));
+}
+
+int32_t TrajectoryInterpolator::evaluate(uint8_t joint, uint32_t now)
+{
+    if(joint >= jointCount || waypointCounts[joint] == 0)
+    {
+        return(joint < jointCount ? setpoints[joint] : 0);
+    }
+
+    // Drops the waypoints before the current segment, but keeps one for the tangent of its start
+    uint8_t& count = waypointCounts[joint];
+    DynamixelWaypoint* points = waypoints[joint];
+    while(count >= 3 && (int32_t)(now - points[2].time) >= 0)
+    {
+        memmove(points, points+1, (count-1)*sizeof(DynamixelWaypoint));
+        count--;
+    }
+
+    uint8_t start = (count >= 2 && (int32_t)(now - points[1].time) >= 0) ? 1 : 0;
+    int32_t setpoint;
+    if((int32_t)(now - points[start].time) < 0)
+    {
+        // Before the first waypoint
+        setpoint = points[start].position;
+    }
+    else if(start+1 >= count)
+    {
+        // After the last waypoint
+        setpoint = points[start].position;
+    }
+    else
+    {
+        const DynamixelWaypoint& from = points[start];
+        const DynamixelWaypoint& to = points[start+1];
+        uint32_t duration = to.time - from.time;
+
+        // Slopes are frozen when the segment starts, the next one starts with the end slope of this one
+        int32_t* slopes = segmentSlopes[joint];
+        uint32_t* times = segmentTimes[joint];
+        if(!segmentFrozen[joint] || times[0] != from.time || times[1] != to.time)
+        {
+            bool follows = segmentFrozen[joint] && times[1] == from.time;
+            slopes[0] = follows ? slopes[1] : slope(joint, start);
+            slopes[1] = slope(joint, start+1);
+            times[0] = from.time;
+            times[1] = to.time;
+            segmentFrozen[joint] = true;
+        }
+        int64_t fromTangent = ((int64_t)slopes[0]*duration + 32768) >> 16;
+        int64_t toTangent = ((int64_t)slopes[1]*duration + 32768) >> 16;
+
+        // Hermite basis in Q16
+        int64_t s = ((int64_t)(now - from.time) << 16) / duration;
+        int64_t s2 = (s*s) >> 16;
+        int64_t s3 = (s2*s) >> 16;
+        int64_t h00 = 2*s3 - 3*s2 + 65536;
+        int64_t h10 = s3 - 2*s2 + s;
+        int64_t h01 = -2*s3 + 3*s2;
+        int64_t h11 = s3 - s2;
+
+        int64_t value = h00*from.position + h10*fromTangent + h01*to.position + h11*toTangent;
+        setpoint = (int32_t)((value + 32768) >> 16);
+    }
+
+    setpoints[joint] = setpoint;
+    hasSetpoint[joint] = true;
+    return(setpoint);
+}
+
+bool TrajectoryInterpolator::update(uint32_t now)
+{
+    char* data = syncWrite.getData();
+    bool complete = true;
+    for(uint8_t joint = 0; joint < jointCount; joint++)
+    {
+        encodeLittleEndian(data + 4*joint, evaluate(joint, now), 4);
+        complete &= hasSetpoint[joint];
+    }
+
+    if(!complete)
+    {
+        return(false);
+    }
+    syncWrite.prepareFrame();
+    syncWrite.sendFrame();
+    return(true);
+}
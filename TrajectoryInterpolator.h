@@ -0,0 +1,82 @@
+//
+// Created by agent on 16/10/26.
+//
+
+#ifndef DYNAMIXEL_TRAJECTORY_INTERPOLATOR_H
+#define DYNAMIXEL_TRAJECTORY_INTERPOLATOR_H
+
+#include "Arduino.h"
+#include "DynamixelUtils.h"
+#include "SyncWrite.h"
+
+#ifndef DYN_MAX_WAYPOINTS
+#define DYN_MAX_WAYPOINTS 8         //!< Waypoints buffered per joint
+#endif
+
+//! Timestamped joint position
+struct DynamixelWaypoint {
+    uint32_t time;          //!< micros() value
+    int32_t position;       //!< Raw goal value, e.g. encoder ticks
+};
+
+//! Onboard interpolation of sparse waypoints into control rate setpoints
+/*!
+ * Each joint buffers timestamped waypoints. At each control cycle, update() evaluates a cubic Hermite spline through
+ * them in fixed point, and sends the setpoints of every joint with a single double-buffered SyncWrite. Tangents are
+ * Catmull-Rom ones, null at both ends of the buffer and on extrema, and bounded by three times the slope of both
+ * adjacent segments (Fritsch-Carlson): every segment is monotone, joints never overshoot a waypoint.
+ * <br>The tangents of a segment are frozen when it starts, so that the setpoint never jumps: a waypoint appended
+ * during the last buffered segment only shapes the next ones, and the joint stops on the end of that segment first.
+ * <br>The host link thus only has to carry sparse waypoints, ahead of time. If it falls behind, joints smoothly stop on
+ * their last waypoint.
+ */
+class TrajectoryInterpolator {
+
+public:
+
+    /*!
+     * @param goal 4 bytes goal register written by the SyncWrite, e.g. the model goalAngle
+     */
+    TrajectoryInterpolator(const DynamixelManager&, uint8_t jointCount, const DynamixelAccessData& goal);
+
+    //! Sets the motor ID of a joint
+    void setJointID(uint8_t joint, uint8_t id);
+
+    //! Appends a waypoint to a joint, false if its buffer is full or if time does not increase
+    bool addWaypoint(uint8_t joint, uint32_t time, int32_t position);
+
+    //! Drops every waypoint of a joint, it holds its last setpoint
+    void clear(uint8_t joint);
+
+    //! Number of waypoints buffered for a joint, including the one before the current segment
+    uint8_t getWaypointCount(uint8_t joint) const;
+
+    //! Setpoint of a joint at the given time, consuming the waypoints of the segments already done
+    int32_t evaluate(uint8_t joint, uint32_t now);
+
+    /*!
+     * Evaluates every joint and sends their setpoints with a single SyncWrite
+     * @return false if some joint never got any waypoint yet, nothing is sent then
+     */
+    bool update(uint32_t now);
+
+private:
+
+    //! Velocity at waypoint i in Q16 units per microsecond, 0 at both ends of the buffer and on extrema
+    int32_t slope(uint8_t joint, uint8_t i) const;
+
+    StaticSyncWrite<DYN_MAX_MOTORS, 4> syncWrite;
+    uint8_t jointCount;
+
+    DynamixelWaypoint waypoints[DYN_MAX_MOTORS][DYN_MAX_WAYPOINTS];
+    uint8_t waypointCounts[DYN_MAX_MOTORS];
+    int32_t setpoints[DYN_MAX_MOTORS];
+    bool hasSetpoint[DYN_MAX_MOTORS];
+
+    //! Start and end times of the segment being evaluated, and the slopes frozen at its ends
+    uint32_t segmentTimes[DYN_MAX_MOTORS][2];
+    int32_t segmentSlopes[DYN_MAX_MOTORS][2];
+    bool segmentFrozen[DYN_MAX_MOTORS];
+};
+
+#endif //DYNAMIXEL_TRAJECTORY_INTERPOLATOR_H
@@ -5,30 +5,57 @@
 #include "XL430.h"
 
 // Definition of previously declared static members to prevent conflicts during linking
-
-const DynamixelAccessData& XL430::xl430ID = DynamixelAccessData(0x07,0x00,1);
-const DynamixelAccessData& XL430::xl430LED = DynamixelAccessData(0x41,0x00,1);
-const DynamixelAccessData& XL430::xl430TorqueEnable = DynamixelAccessData(0x40,0x00,1);
-const DynamixelAccessData& XL430::xl430CurrentTorque = DynamixelAccessData(126,0x00,2);
-const DynamixelAccessData& XL430::xl430GoalAngle = DynamixelAccessData(0x74,0x00,4);
-const DynamixelAccessData& XL430::xl430CurrentAngle = DynamixelAccessData(0x84,0x00,4);
-const DynamixelAccessData& XL430::xl430GoalVelocity = DynamixelAccessData(0x68,0x00,4);
-const DynamixelAccessData& XL430::xl430CurrentVelocity = DynamixelAccessData(0x80,0x00,4);
-const DynamixelAccessData& XL430::xl430OperatingMode = DynamixelAccessData(0x0B,0x00,1);
-const DynamixelAccessData& XL430::xl430VelocityLimit = DynamixelAccessData(112,0x00,4);
-const DynamixelAccessData& XL430::xl430Moving = DynamixelAccessData(122,0x00,1);
-const DynamixelAccessData& XL430::xl430MovingStatus = DynamixelAccessData(123,0x00,1);
-const DynamixelAccessData& XL430::xl430ReturnDelay = DynamixelAccessData(9,0x00,1);
-const DynamixelAccessData& XL430::xl430HardwareError = DynamixelAccessData(70,0x00,1);
-const DynamixelAccessData& XL430::xl430MovingThreshold = DynamixelAccessData(24,0x00,4);
-const DynamixelAccessData& XL430::xl430MovingOffset = DynamixelAccessData(20,0x00,4);
-
-XL430::XL430(uint8_t id, const DynamixelPacketSender& dynamixelManager) : DynamixelMotor(id, DynamixelMotorData(id, xl430ID,
-                                          xl430LED,xl430TorqueEnable,xl430CurrentTorque, xl430GoalAngle, xl430CurrentAngle,
-                                          xl430GoalVelocity,xl430CurrentVelocity,
-                                           xl430OperatingMode,
-                                          torqueConversionFactor,
-                                          angleConversionFactor,velocityConversionFactor), dynamixelManager)
+// They are constexpr-constructed, thus stored in flash with no static initialization
+
+constexpr DynamixelAccessData XL430::xl430ID = DynamixelAccessData(0x07,0x00,1);
+constexpr DynamixelAccessData XL430::xl430LED = DynamixelAccessData(0x41,0x00,1);
+constexpr DynamixelAccessData XL430::xl430TorqueEnable = DynamixelAccessData(0x40,0x00,1);
+constexpr DynamixelAccessData XL430::xl430CurrentTorque = DynamixelAccessData(126,0x00,2);
+constexpr DynamixelAccessData XL430::xl430GoalAngle = DynamixelAccessData(0x74,0x00,4);
+constexpr DynamixelAccessData XL430::xl430CurrentAngle = DynamixelAccessData(0x84,0x00,4);
+constexpr DynamixelAccessData XL430::xl430GoalVelocity = DynamixelAccessData(0x68,0x00,4);
+constexpr DynamixelAccessData XL430::xl430CurrentVelocity = DynamixelAccessData(0x80,0x00,4);
+constexpr DynamixelAccessData XL430::xl430OperatingMode = DynamixelAccessData(0x0B,0x00,1);
+constexpr DynamixelAccessData XL430::xl430RealtimeTick = DynamixelAccessData(120,0x00,2);
+constexpr DynamixelAccessData XL430::xl430VelocityLimit = DynamixelAccessData(112,0x00,4);
+constexpr DynamixelAccessData XL430::xl430Moving = DynamixelAccessData(122,0x00,1);
+constexpr DynamixelAccessData XL430::xl430MovingStatus = DynamixelAccessData(123,0x00,1);
+constexpr DynamixelAccessData XL430::xl430ReturnDelay = DynamixelAccessData(9,0x00,1);
+constexpr DynamixelAccessData XL430::xl430HardwareError = DynamixelAccessData(70,0x00,1);
+constexpr DynamixelAccessData XL430::xl430MovingThreshold = DynamixelAccessData(24,0x00,4);
+constexpr DynamixelAccessData XL430::xl430MovingOffset = DynamixelAccessData(20,0x00,4);
+constexpr DynamixelAccessData XL430::xl430ProfileAcceleration = DynamixelAccessData(108,0x00,4);
+constexpr DynamixelAccessData XL430::xl430ProfileVelocity = DynamixelAccessData(112,0x00,4);
+
+// RAM area fields, in address order. Fields 0-4 : torque, LED, status return level, registered instruction, hardware
+// error. 5-11 : gains. 12 : bus watchdog, 13-17 : goals and profiles, 18-28 : read-only present values.
+static constexpr uint8_t NO = DynamixelShadowLayout::noField;
+static constexpr uint8_t xl430RAMFields[83] = {
+         0,  1, NO, NO,  2,  3,  4, NO,   // 64-71
+        NO, NO, NO, NO,  5,  5,  6,  6,   // 72-79
+         7,  7,  8,  8,  9,  9, NO, NO,   // 80-87
+        10, 10, 11, 11, NO, NO, NO, NO,   // 88-95
+        NO, NO, 12, NO, 13, 13, NO, NO,   // 96-103
+        14, 14, 14, 14, 15, 15, 15, 15,   // 104-111
+        16, 16, 16, 16, 17, 17, 17, 17,   // 112-119
+        18, 18, 19, 20, 21, 21, 22, 22,   // 120-127
+        23, 23, 23, 23, 24, 24, 24, 24,   // 128-135
+        25, 25, 25, 25, 26, 26, 26, 26,   // 136-143
+        27, 27, 28                        // 144-146, the control table ends here
+};
+
+// Gains, goals and profiles are only ever changed by the host, re-writing their known value is harmless.
+// Torque enable is excluded as the motor disables it by itself on hardware errors.
+constexpr DynamixelShadowLayout XL430::xl430ShadowLayout = {64, 83, xl430RAMFields, 0x0003EFE0};
+
+constexpr DynamixelModel XL430::xl430Model = {xl430ID, xl430LED, xl430TorqueEnable, xl430CurrentTorque,
+                                              xl430GoalAngle, xl430CurrentAngle, xl430GoalVelocity, xl430CurrentVelocity,
+                                              xl430OperatingMode, xl430RealtimeTick, xl430HardwareError,
+                                              torqueConversionFactor, angleConversionFactor, velocityConversionFactor,
+                                              angleFixedScale, velocityFixedScale,
+                                              &xl430ShadowLayout};
+
+XL430::XL430(uint8_t id, const DynamixelPacketSender& dynamixelManager) : DynamixelMotor(id, xl430Model, dynamixelManager)
 {
 
 }
@@ -45,8 +72,7 @@ DynamixelPacketData* XL430::makeWritePacket(DynamixelAccessData accessData, char
         position ++;
     }
 
-    packet[position] = motorData.motorID;
-    motorData.motorID = motorID;            // This allows to change motor ID and keep communicating
+    packet[position] = motorID;
     position ++;
     int instructionsLength = dynamixelV2::minInstructionLength+accessData.length;
     packet[position] = instructionsLength & 0xFF;
@@ -86,8 +112,7 @@ DynamixelPacketData* XL430::makeReadPacket(DynamixelAccessData accessData)
     }
 
     // Packet ID
-    packet[position++] = motorData.motorID;
-    motorID = motorData.motorID;
+    packet[position++] = motorID;
 
     // Instruction Length: 4(params) +3
     packet[position++] = 7;
@@ -111,30 +136,21 @@ DynamixelPacketData* XL430::makeReadPacket(DynamixelAccessData accessData)
 
 bool XL430::decapsulatePacket(const char *packet)
 {
-    unsigned short responseLength = dynamixelV2::minResponseLength + packet[dynamixelV2::lengthLSBPos] + (packet[dynamixelV2::lengthMSBPos] << 8);
-
-    // Checks CRC
-    if(crc_compute(packet,responseLength) == (packet[responseLength]+(packet[responseLength+1] << 8)))
+    bool alert;
+    bool status = checkV2Status(packet, alert);
+    if(status)
     {
-        // If valid, checks alert byte and instruction type
-        if(!((uint8_t)packet[8] & dynamixelV2::alertBit) && (int)packet[dynamixelV2::instructionPos] == dynamixelV2::statusInstruction)
-        {
-            return(true);
-        }
+        noteAlert(alert);
     }
-    return(false);
+    return(status);
 }
 
 bool XL430::decapsulatePacket(const char *packet, float &value)
 {
     if(decapsulatePacket(packet))
     {
-        int parameterLength = packet[dynamixelV2::lengthLSBPos] + (packet[dynamixelV2::lengthMSBPos] << 8) - 4;
-
-        for(int i = 0; i<parameterLength; i++)
-        {
-            value += (int)(packet[dynamixelV2::responseParameterStart+i] << 8*i);
-        }
+        int parameterLength = (uint8_t)packet[dynamixelV2::lengthLSBPos] + ((uint8_t)packet[dynamixelV2::lengthMSBPos] << 8) - 4;
+        value = decodeLittleEndian(packet + dynamixelV2::responseParameterStart, (uint8_t)parameterLength);
 
         return(true);
     }
@@ -149,12 +165,8 @@ bool XL430::decapsulatePacket(const char *packet, int &value)
 {
     if(decapsulatePacket(packet))
     {
-        int parameterLength = packet[dynamixelV2::lengthLSBPos] + (packet[dynamixelV2::lengthMSBPos] << 8) - 4;
-
-        for(int i = 0; i<parameterLength; i++)
-        {
-            value += (int)(packet[dynamixelV2::responseParameterStart+i] << 8*i);
-        }
+        int parameterLength = (uint8_t)packet[dynamixelV2::lengthLSBPos] + ((uint8_t)packet[dynamixelV2::lengthMSBPos] << 8) - 4;
+        value = decodeLittleEndian(packet + dynamixelV2::responseParameterStart, (uint8_t)parameterLength);
 
         return(true);
     }
@@ -167,5 +179,56 @@ bool XL430::decapsulatePacket(const char *packet, int &value)
 
 
 DynamixelMotor* XL430GeneratorFunction(uint8_t id, DynamixelPacketSender* packetSender) {
-    return new XL430(id, *packetSender);
-}
\ No newline at end of file
+    return XL430ArenaGeneratorFunction<DYN_XL430_ARENA_SIZE>(id, packetSender);
+}
+
+bool XL430::setTimeBasedProfile(bool state)
+{
+    uint8_t driveMode = 0;
+    if(!read<XL430Registers::DriveMode>(driveMode))
+    {
+        return(false);
+    }
+    driveMode = state ? (driveMode | TIME_BASED_PROFILE) : (driveMode & ~TIME_BASED_PROFILE);
+    return(write<XL430Registers::DriveMode>(driveMode));
+}
+
+bool XL430::move(const XL430Motion& motion)
+{
+    char parameters[XL430MotionBlock::length];
+    XL430MotionBlock::store(parameters, motion);
+    return(writeValue(XL430MotionBlock::access(), parameters));
+}
+
+bool XL430::moveTo(float angleDegree, uint32_t durationMs, uint32_t accelerationMs)
+{
+    int32_t goal = unitsToValue(angleDegree, model.valueToAngle, model.goalAngle.length);
+    return(move(timeBasedMotion(goal, durationMs, accelerationMs)));
+}
+
+XL430Motion XL430::timeBasedMotion(int32_t goal, uint32_t durationMs, uint32_t accelerationMs)
+{
+    // A null Profile Velocity would mean an infinite velocity, i.e. no profile at all
+    durationMs = max(durationMs, (uint32_t)1);
+    accelerationMs = min(accelerationMs, durationMs/2);
+    return(XL430Motion{accelerationMs, durationMs, goal});
+}
+
+XL430Motion XL430::velocityBasedMotion(int32_t from, int32_t goal, uint32_t durationMs, uint32_t accelerationMs)
+{
+    durationMs = max(durationMs, (uint32_t)2);
+    accelerationMs = max(min(accelerationMs, durationMs/2), (uint32_t)1);
+    uint64_t distance = (uint64_t)(goal > from ? goal - from : from - goal);
+    uint64_t cruiseMs = durationMs - accelerationMs;
+
+    // Trapezoid of the given duration: peak velocity is distance/cruise time, reached in the acceleration time.
+    // 1 velocity unit = 0.229*4096/60000 ticks/ms, 1 acceleration unit = 214.577*4096/60000² ticks/ms².
+    // Both are rounded up so that the move does not last longer than asked.
+    uint64_t velocity = (distance*60000000 + 937984*cruiseMs - 1) / (937984*cruiseMs);
+    uint64_t acceleration = (distance*3600000000ULL + 878907*cruiseMs*accelerationMs - 1) / (878907*cruiseMs*accelerationMs);
+
+    // 0 would mean an unlimited profile
+    velocity = max(min(velocity, (uint64_t)0xFFFFFFFF), (uint64_t)1);
+    acceleration = max(min(acceleration, (uint64_t)0xFFFFFFFF), (uint64_t)1);
+    return(XL430Motion{(uint32_t)acceleration, (uint32_t)velocity, goal});
+}
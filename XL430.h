@@ -6,6 +6,7 @@
 #define XL30_XL430_H
 
 #include "DynamixelMotor.h"
+#include "BasicMotor.h"
 
 enum XL430OperatingModes {
     VELOCITY_CONTROL_MODE = 1,
@@ -14,6 +15,92 @@ enum XL430OperatingModes {
     PWN_CONTROL_MODE = 16,
 };
 
+//! Typed XL430 control table, for DynamixelMotor::read() and DynamixelMotor::write()
+namespace XL430Registers {
+    // EEPROM area
+    typedef Register<0, uint16_t> ModelNumber;
+    typedef Register<2, uint32_t> ModelInformation;
+    typedef Register<6, uint8_t> FirmwareVersion;
+    typedef Register<7, uint8_t> ID;
+    typedef Register<8, uint8_t> BaudRate;
+    typedef Register<9, uint8_t> ReturnDelayTime;
+    typedef Register<10, uint8_t> DriveMode;
+    typedef Register<11, uint8_t> OperatingMode;
+    typedef Register<12, uint8_t> SecondaryID;
+    typedef Register<13, uint8_t> ProtocolType;
+    typedef Register<20, int32_t> HomingOffset;
+    typedef Register<24, uint32_t> MovingThreshold;
+    typedef Register<31, uint8_t> TemperatureLimit;
+    typedef Register<32, uint16_t> MaxVoltageLimit;
+    typedef Register<34, uint16_t> MinVoltageLimit;
+    typedef Register<36, uint16_t> PWMLimit;
+    typedef Register<44, uint32_t> VelocityLimit;
+    typedef Register<48, uint32_t> MaxPositionLimit;
+    typedef Register<52, uint32_t> MinPositionLimit;
+    typedef Register<63, uint8_t> Shutdown;
+
+    // RAM area
+    typedef Register<64, uint8_t> TorqueEnable;
+    typedef Register<65, uint8_t> LED;
+    typedef Register<68, uint8_t> StatusReturnLevel;
+    typedef Register<69, uint8_t> RegisteredInstruction;
+    typedef Register<70, uint8_t> HardwareErrorStatus;
+    typedef Register<76, uint16_t> VelocityIGain;
+    typedef Register<78, uint16_t> VelocityPGain;
+    typedef Register<80, uint16_t> PositionDGain;
+    typedef Register<82, uint16_t> PositionIGain;
+    typedef Register<84, uint16_t> PositionPGain;
+    typedef Register<88, uint16_t> Feedforward2ndGain;
+    typedef Register<90, uint16_t> Feedforward1stGain;
+    typedef Register<98, int8_t> BusWatchdog;
+    typedef Register<100, int16_t> GoalPWM;
+    typedef Register<104, int32_t> GoalVelocity;
+    typedef Register<108, uint32_t> ProfileAcceleration;
+    typedef Register<112, uint32_t> ProfileVelocity;
+    typedef Register<116, int32_t> GoalPosition;
+    typedef Register<120, uint16_t> RealtimeTick;
+    typedef Register<122, uint8_t> Moving;
+    typedef Register<123, uint8_t> MovingStatus;
+    typedef Register<124, int16_t> PresentPWM;
+    typedef Register<126, int16_t> PresentLoad;
+    typedef Register<128, int32_t> PresentVelocity;
+    typedef Register<132, int32_t> PresentPosition;
+    typedef Register<136, int32_t> VelocityTrajectory;
+    typedef Register<140, int32_t> PositionTrajectory;
+    typedef Register<144, uint16_t> PresentInputVoltage;
+    typedef Register<146, uint8_t> PresentTemperature;
+}
+
+//! Drive Mode bits
+enum XL430DriveModes {
+    REVERSE_MODE = 1,
+    TIME_BASED_PROFILE = 4      //!< Profile Velocity and Profile Acceleration are durations in ms instead of limits
+};
+
+//! Moving Status bits
+enum XL430MovingStatus {
+    IN_POSITION = 1,
+    PROFILE_ONGOING = 2
+};
+
+//! Move executed by the trapezoidal profile generator of the XL430, written at once with XL430MotionBlock (108-119)
+/*!
+ * In time-based profile (see XL430::setTimeBasedProfile()), acceleration and velocity are the acceleration time and
+ * the total time of the move, in ms. Otherwise they are the profile limits, in 214.577 rev/min² and 0.229 rpm units.
+ * <br>Several motors move with a single StaticSyncWrite<N, XL430MotionBlock::length>, filled with
+ * XL430MotionBlock::store().
+ */
+struct XL430Motion {
+    uint32_t acceleration;
+    uint32_t velocity;
+    int32_t goal;           //!< Goal Position, in encoder ticks
+};
+
+typedef RegisterBlock<XL430Motion,
+        RegisterField<XL430Registers::ProfileAcceleration, XL430Motion, &XL430Motion::acceleration>,
+        RegisterField<XL430Registers::ProfileVelocity, XL430Motion, &XL430Motion::velocity>,
+        RegisterField<XL430Registers::GoalPosition, XL430Motion, &XL430Motion::goal>> XL430MotionBlock;
+
 //! XL430-specific class
 /*!
  * \sa XL430 documentation : http://emanual.robotis.com/docs/en/dxl/x/xl430-w250/
@@ -29,31 +116,164 @@ public:
     bool decapsulatePacket(const char *, float &) override;
     bool decapsulatePacket(const char *, int &) override;
 
+    /*!
+     * \name Motion profiles
+     * Moves are interpolated by the servo itself: each one costs a single frame instead of a stream of goals.
+     */
+    //!@{
+
+    //! Selects time-based or velocity-based profiles. Drive Mode is in EEPROM, torque has to be disabled first.
+    bool setTimeBasedProfile(bool);
+
+    //! Writes the profile and the goal of a move in a single transaction
+    bool move(const XL430Motion&);
+
+    //! Moves to the given angle in durationMs, accelerating for accelerationMs. Requires the time-based profile.
+    bool moveTo(float angleDegree, uint32_t durationMs, uint32_t accelerationMs);
+
+    /*!
+     * Time-based profile of a move. The acceleration time is limited to half of the duration, as required by the
+     * XL430.
+     */
+    static XL430Motion timeBasedMotion(int32_t goal, uint32_t durationMs, uint32_t accelerationMs);
+
+    /*!
+     * Velocity-based profile of a move from the given position, computed to last durationMs with accelerationMs of
+     * acceleration and deceleration. Integer only.
+     */
+    static XL430Motion velocityBasedMotion(int32_t from, int32_t goal, uint32_t durationMs, uint32_t accelerationMs);
+    //!@}
+
     //! The static members are used in order to minimize the memory usage of each individual object.
-    static const DynamixelAccessData& xl430GoalAngle;
-    static const DynamixelAccessData& xl430ID;
-    static const DynamixelAccessData& xl430LED;
-    static const DynamixelAccessData& xl430TorqueEnable;
-    static const DynamixelAccessData& xl430CurrentTorque;
-    static const DynamixelAccessData& xl430CurrentAngle;
-    static const DynamixelAccessData& xl430GoalVelocity;
-    static const DynamixelAccessData& xl430CurrentVelocity;
-    static const DynamixelAccessData& xl430OperatingMode;
-    static const DynamixelAccessData& xl430VelocityLimit;
-    static const DynamixelAccessData& xl430Moving;
-    static const DynamixelAccessData& xl430MovingStatus;
-    static const DynamixelAccessData& xl430ReturnDelay;
-    static const DynamixelAccessData& xl430HardwareError;
-    static const DynamixelAccessData& xl430MovingThreshold;
-    static const DynamixelAccessData& xl430MovingOffset;
-
-private:
+    static const DynamixelAccessData xl430GoalAngle;
+    static const DynamixelAccessData xl430ID;
+    static const DynamixelAccessData xl430LED;
+    static const DynamixelAccessData xl430TorqueEnable;
+    static const DynamixelAccessData xl430CurrentTorque;
+    static const DynamixelAccessData xl430CurrentAngle;
+    static const DynamixelAccessData xl430GoalVelocity;
+    static const DynamixelAccessData xl430CurrentVelocity;
+    static const DynamixelAccessData xl430OperatingMode;
+    static const DynamixelAccessData xl430RealtimeTick;
+    static const DynamixelAccessData xl430VelocityLimit;
+    static const DynamixelAccessData xl430Moving;
+    static const DynamixelAccessData xl430MovingStatus;
+    static const DynamixelAccessData xl430ReturnDelay;
+    static const DynamixelAccessData xl430HardwareError;
+    static const DynamixelAccessData xl430MovingThreshold;
+    static const DynamixelAccessData xl430MovingOffset;
+    static const DynamixelAccessData xl430ProfileAcceleration;
+    static const DynamixelAccessData xl430ProfileVelocity;
+
+    //! Whole RAM area (64-146), mirrored by each motor shadow
+    static const DynamixelShadowLayout xl430ShadowLayout;
+
+    //! Shared by every XL430, in flash
+    static const DynamixelModel xl430Model;
 
     static constexpr float torqueConversionFactor = 1/1024.0f;
     static constexpr float angleConversionFactor = 0.088;
     static constexpr float velocityConversionFactor = 0.229;
+    static constexpr int32_t angleFixedScale = 88;          //!< Millidegrees per encoder tick
+    static constexpr int32_t velocityFixedScale = 229;      //!< Milli-rpm per velocity unit
+    typedef FixedPointScale<angleFixedScale> AngleScale;
+    typedef FixedPointScale<velocityFixedScale> VelocityScale;
+
+protected:
+
+    int32_t fixedAngleToValue(Millidegrees angle, uint8_t length) const override
+    {
+        return(AngleScale::toValue(angle, length));
+    }
+
+    Millidegrees fixedAngleFromValue(int32_t value) const override
+    {
+        return(AngleScale::fromValue(value));
+    }
+
+    int32_t fixedVelocityToValue(MilliRpm velocity, uint8_t length) const override
+    {
+        return(VelocityScale::toValue(velocity, length));
+    }
+
+    MilliRpm fixedVelocityFromValue(int32_t value) const override
+    {
+        return(VelocityScale::fromValue(value));
+    }
+};
+
+//! Present load, velocity and position of a XL430 (126-135), read at once with XL430JointStateBlock
+struct XL430JointState {
+    int16_t current;        //!< Present Load, the XL430 has no current sensor
+    int32_t velocity;
+    int32_t position;
+};
+
+typedef RegisterBlock<XL430JointState,
+        RegisterField<XL430Registers::PresentLoad, XL430JointState, &XL430JointState::current>,
+        RegisterField<XL430Registers::PresentVelocity, XL430JointState, &XL430JointState::velocity>,
+        RegisterField<XL430Registers::PresentPosition, XL430JointState, &XL430JointState::position>> XL430JointStateBlock;
+
+//! Moving Status, present velocity and position of a XL430 (123-135), read at once with XL430SettleBlock
+struct XL430SettleState {
+    uint8_t movingStatus;   //!< XL430MovingStatus flags
+    int32_t velocity;
+    int32_t position;
+};
+
+typedef RegisterBlock<XL430SettleState,
+        RegisterField<XL430Registers::MovingStatus, XL430SettleState, &XL430SettleState::movingStatus>,
+        RegisterField<XL430Registers::PresentVelocity, XL430SettleState, &XL430SettleState::velocity>,
+        RegisterField<XL430Registers::PresentPosition, XL430SettleState, &XL430SettleState::position>> XL430SettleBlock;
+
+//! Statically dispatched XL430, for inlined hot paths
+/*!
+ * Same protocol and conversions as XL430, without any virtual call nor per-motor cache.
+ * \sa BasicMotor, and BasicMotorAdapter<StaticXL430> to use it as a DynamixelMotor.
+ */
+class StaticXL430 : public BasicMotor<StaticXL430>
+{
+public:
+    StaticXL430(uint8_t id, const DynamixelManager& dynamixelManager) : BasicMotor(id, dynamixelManager)
+    {}
+
+    typedef XL430Registers::GoalPosition GoalAngle;
+    typedef XL430Registers::PresentPosition CurrentAngle;
+    typedef XL430Registers::GoalVelocity GoalVelocity;
+    typedef XL430Registers::PresentVelocity CurrentVelocity;
+    typedef XL430Registers::PresentLoad CurrentTorque;
+    typedef XL430Registers::TorqueEnable TorqueEnable;
+    typedef XL430Registers::LED LED;
+    typedef XL430Registers::OperatingMode OperatingMode;
+
+    static constexpr float angleConversionFactor = XL430::angleConversionFactor;
+    static constexpr float velocityConversionFactor = XL430::velocityConversionFactor;
+    typedef XL430::AngleScale AngleScale;
+    typedef XL430::VelocityScale VelocityScale;
+
+    static const DynamixelModel& model()
+    {
+        return(XL430::xl430Model);
+    }
 };
 
+/*!
+ * Creates an XL430 in a static arena of Capacity motors, returns nullptr once it is full. Each capacity has its own
+ * arena, so that the application only reserves the RAM of the motors it has, e.g.
+ * manager.createMotor(id, XL430ArenaGeneratorFunction<4>)
+ */
+template<unsigned int Capacity>
+DynamixelMotor* XL430ArenaGeneratorFunction(uint8_t id, DynamixelPacketSender* packetSender)
+{
+    static DynamixelMotorArena<XL430, Capacity> arena;
+    return(arena.create(id, *packetSender));
+}
+
+#ifndef DYN_XL430_ARENA_SIZE
+#define DYN_XL430_ARENA_SIZE 4      //!< Capacity of the arena used by XL430GeneratorFunction
+#endif
+
+//! Creates an XL430 in a static arena of DYN_XL430_ARENA_SIZE motors, returns nullptr once it is full
 DynamixelMotor* XL430GeneratorFunction(uint8_t id, DynamixelPacketSender* packetSender);
 
 
@@ -0,0 +1,106 @@
+//
+// Created by agent on 16/10/26.
+//
+
+/*
+ * Times the float (unitsToValue) and fixed-point (FixedPointScale) angle and velocity conversions of the XL430, and
+ * prints the results on the USB serial. No motor is needed.
+ * <br>On boards without a cycle counter (Teensy LC), cycles are derived from micros() and F_CPU.
+ */
+
+#include "Arduino.h"
+#include "DynamixelConversion.h"
+#include "DynamixelFixedPoint.h"
+#include "XL430.h"
+
+static const int32_t iterations = 20000;
+static const uint8_t inputCount = 64;
+
+static float angles[inputCount];
+static Millidegrees fixedAngles[inputCount];
+static float velocities[inputCount];
+static MilliRpm fixedVelocities[inputCount];
+
+static volatile int32_t sink;
+
+static inline uint32_t cycleCount()
+{
+#ifdef ARM_DWT_CYCCNT
+    return(ARM_DWT_CYCCNT);
+#else
+    return(0);
+#endif
+}
+
+//! Runs the conversion over every input, in a loop, and returns the time taken in microseconds
+template<typename Conversion>
+static uint32_t run(Conversion convert, uint32_t& cycles)
+{
+    uint32_t startCycles = cycleCount();
+    uint32_t start = micros();
+    for(int32_t i = 0; i < iterations; i++)
+    {
+        sink = convert(i % inputCount);
+    }
+    uint32_t elapsed = micros() - start;
+    cycles = cycleCount() - startCycles;
+    return(elapsed);
+}
+
+template<typename Conversion>
+static void bench(const char* name, Conversion convert, uint32_t loopMicros, uint32_t loopCycles)
+{
+    uint32_t cycles;
+    uint32_t elapsed = run(convert, cycles) - loopMicros;
+#ifdef ARM_DWT_CYCCNT
+    cycles -= loopCycles;
+#else
+    cycles = (uint32_t)((uint64_t)elapsed*(F_CPU/1000000));
+#endif
+    Serial.printf("%-16s %6lu us, %5lu ns and %4lu cycles per conversion\r\n", name, elapsed,
+                  (uint32_t)((uint64_t)elapsed*1000/iterations), cycles/iterations);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    while(!Serial && millis() < 3000)
+    {}
+
+#ifdef ARM_DWT_CYCCNT
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+
+    for(uint8_t i = 0; i < inputCount; i++)
+    {
+        fixedAngles[i] = (int32_t)i*5623 - 180000;
+        angles[i] = fixedAngles[i]/1000.0f;
+        fixedVelocities[i] = (int32_t)i*1531 - 50000;
+        velocities[i] = fixedVelocities[i]/1000.0f;
+    }
+}
+
+void loop()
+{
+    // Loop and store overhead, subtracted from every measure
+    uint32_t loopCycles;
+    uint32_t loopMicros = run([](uint8_t i) { return(fixedAngles[i]); }, loopCycles);
+
+    Serial.printf("F_CPU %lu Hz, %ld conversions each\r\n", (uint32_t)F_CPU, iterations);
+    bench("angle float", [](uint8_t i) {
+        return(unitsToValue(angles[i], XL430::angleConversionFactor, 4));
+    }, loopMicros, loopCycles);
+    bench("angle fixed", [](uint8_t i) {
+        return(FixedPointScale<XL430::angleFixedScale>::toValue(fixedAngles[i], 4));
+    }, loopMicros, loopCycles);
+    bench("velocity float", [](uint8_t i) {
+        return(unitsToValue(velocities[i], XL430::velocityConversionFactor, 4));
+    }, loopMicros, loopCycles);
+    bench("velocity fixed", [](uint8_t i) {
+        return(FixedPointScale<XL430::velocityFixedScale>::toValue(fixedVelocities[i], 4));
+    }, loopMicros, loopCycles);
+    Serial.println();
+
+    delay(2000);
+}
@@ -0,0 +1,85 @@
+//
+// Created by agent on 16/10/26.
+//
+
+/*
+ * Times setGoalAngle() through a DynamixelMotor* (XL430, virtual calls and shadow update) and through StaticXL430
+ * (statically dispatched), and prints the results on the USB serial.
+ * <br>Needs one XL430 on Serial1, torque may stay off. Both paths send the same packet and wait for the same answer,
+ * so the difference between them is the processor time saved, the bus time being the same.
+ * <br>On boards without a cycle counter (Teensy LC), cycles are derived from micros() and F_CPU.
+ */
+
+#include "Arduino.h"
+#include "DynamixelManager.h"
+#include "XL430.h"
+
+#ifndef BENCH_MOTOR_ID
+#define BENCH_MOTOR_ID 1
+#endif
+
+#ifndef BENCH_BAUDRATE
+#define BENCH_BAUDRATE 57600
+#endif
+
+static const uint16_t iterations = 200;
+
+static DynamixelManager manager(&Serial1, &Serial, BENCH_BAUDRATE);
+static XL430 virtualMotor(BENCH_MOTOR_ID, manager);
+static StaticXL430 staticMotor(BENCH_MOTOR_ID, manager);
+
+static inline uint32_t cycleCount()
+{
+#ifdef ARM_DWT_CYCCNT
+    return(ARM_DWT_CYCCNT);
+#else
+    return(0);
+#endif
+}
+
+//! Calls setGoalAngle() iterations times around the middle position, prints and returns the cycles per call
+template<typename Motor>
+static uint32_t bench(const char* name, Motor& motor)
+{
+    uint16_t failures = 0;
+    uint32_t startCycles = cycleCount();
+    uint32_t start = micros();
+    for(uint16_t i = 0; i < iterations; i++)
+    {
+        failures += !motor.setGoalAngle(i % 2 ? 181.0f : 179.0f);
+    }
+    uint32_t elapsed = micros() - start;
+#ifdef ARM_DWT_CYCCNT
+    uint32_t cycles = (cycleCount() - startCycles)/iterations;
+#else
+    (void)startCycles;
+    uint32_t cycles = (uint32_t)((uint64_t)elapsed*(F_CPU/1000000)/iterations);
+#endif
+    Serial.printf("%-24s %5lu us and %7lu cycles per call, %u failed\r\n", name, elapsed/iterations, cycles, failures);
+    return(cycles);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    while(!Serial && millis() < 3000)
+    {}
+
+#ifdef ARM_DWT_CYCCNT
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+}
+
+void loop()
+{
+    DynamixelMotor& motor = virtualMotor;
+
+    Serial.printf("F_CPU %lu Hz, %lu baud, %u calls each\r\n", (uint32_t)F_CPU, (uint32_t)BENCH_BAUDRATE, iterations);
+    uint32_t virtualCycles = bench("DynamixelMotor* (XL430)", motor);
+    uint32_t staticCycles = bench("StaticXL430", staticMotor);
+    Serial.printf("Static dispatch saves %ld cycles per call\r\n", (int32_t)(virtualCycles - staticCycles));
+    Serial.println();
+
+    delay(2000);
+}